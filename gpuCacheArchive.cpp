@@ -0,0 +1,334 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheArchive.cpp
+ *
+ *  Lightweight, cached description of the objects in an Alembic archive.
+ */
+
+#include "gpuCacheArchive.h"
+#include "gpuCacheLog.h"
+
+#include <ai.h>
+
+#include <Alembic/AbcCoreFactory/All.h>
+#include <Alembic/AbcGeom/All.h>
+
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+
+using namespace Alembic;
+
+namespace
+{
+
+template <class PROPERTY>
+unsigned long long firstSampleSize( const PROPERTY& property )
+{
+        if (!property.valid() || property.getNumSamples() == 0)
+                return 0;
+        Util::Dimensions dims;
+        property.getDimensions( dims, Abc::ISampleSelector((Abc::index_t)0) );
+        return dims.numPoints();
+}
+
+/// Appends the digest of the first sample of 'property' to 'key'. Returns
+/// false when the property has no sample key.
+template <class PROPERTY>
+bool appendSampleKey( const PROPERTY& property, std::string& key )
+{
+        if (!property.valid() || property.getNumSamples() == 0)
+                return false;
+        AbcA::ArraySampleKey sampleKey;
+        if (!property.getKey( sampleKey, Abc::ISampleSelector((Abc::index_t)0) ))
+                return false;
+        key += sampleKey.digest.str();
+        key += ':';
+        return true;
+}
+
+/// Appends the value of the only sample of a scalar property, in hex.
+bool appendScalarKey( const Abc::IScalarProperty& property, std::string& key )
+{
+        const AbcA::DataType& type = property.getDataType();
+        const Abc::ISampleSelector first( (Abc::index_t)0 );
+        if (type.getPod() == AbcA::kStringPOD)
+        {
+                std::vector<std::string> values( type.getExtent() );
+                property.get( &values[0], first );
+                for (size_t i = 0; i < values.size(); ++i)
+                {
+                        key += values[i];
+                        key += '\x1f';
+                }
+                return true;
+        }
+        if (type.getPod() == AbcA::kWstringPOD || type.getNumBytes() == 0)
+                return false;
+
+        std::vector<unsigned char> bytes( type.getNumBytes() );
+        property.get( &bytes[0], first );
+        static const char hex[] = "0123456789abcdef";
+        for (size_t i = 0; i < bytes.size(); ++i)
+        {
+                key += hex[bytes[i] >> 4];
+                key += hex[bytes[i] & 15];
+        }
+        return true;
+}
+
+/// Appends every property under 'compound' to 'key', names included: array
+/// digests, scalar values, compounds recursively. This covers topology, geom
+/// param values and their index properties, subdivision creases, corners and
+/// holes, and arbitrary geom params. Returns false, leaving the object
+/// without a key, if anything is animated or cannot be read.
+bool appendCompoundKey( const Abc::ICompoundProperty& compound, std::string& key )
+{
+        for (size_t i = 0; i < compound.getNumProperties(); ++i)
+        {
+                const AbcA::PropertyHeader& header = compound.getPropertyHeader(i);
+                key += header.getName();
+                key += '=';
+                if (header.isCompound())
+                {
+                        key += '{';
+                        if (!appendCompoundKey( Abc::ICompoundProperty(compound, header.getName()), key ))
+                                return false;
+                        key += '}';
+                }
+                else if (header.isArray())
+                {
+                        Abc::IArrayProperty property( compound, header.getName() );
+                        if (property.getNumSamples() > 1 ||
+                            (property.getNumSamples() == 1 && !appendSampleKey( property, key )))
+                                return false;
+                }
+                else
+                {
+                        Abc::IScalarProperty property( compound, header.getName() );
+                        if (property.getNumSamples() > 1 ||
+                            (property.getNumSamples() == 1 && !appendScalarKey( property, key )))
+                                return false;
+                }
+                key += ';';
+        }
+        return true;
+}
+
+/// Face sets carry per face shading, so they are part of the geometry.
+bool appendFaceSetKeys( const Abc::IObject& object, std::string& key )
+{
+        for (size_t i = 0; i < object.getNumChildren(); ++i)
+        {
+                Abc::IObject child = object.getChild(i);
+                if (!AbcGeom::IFaceSet::matches( child.getMetaData() ))
+                        continue;
+                AbcGeom::IFaceSet faceSet( child, Abc::kWrapExisting );
+                key += "faceset:";
+                key += child.getName();
+                key += child.getMetaData().serialize();
+                key += '{';
+                if (!appendCompoundKey( faceSet.getSchema(), key ))
+                        return false;
+                key += '}';
+        }
+        return true;
+}
+
+/// Key of a static shape, empty if the shape is animated or anything
+/// defining it cannot be hashed.
+template <class SCHEMA>
+std::string geometryKey( const Abc::IObject& object, const SCHEMA& schema )
+{
+        std::string key;
+        if (schema.getPositionsProperty().getNumSamples() != 1 ||
+            !appendCompoundKey( schema, key ) ||
+            !appendFaceSetKeys( object, key ))
+                return std::string();
+        return key;
+}
+
+template <class SCHEMA>
+void readMeshStats( const Abc::IObject& object, const SCHEMA& schema, GpuCacheObjectStats& stats )
+{
+        stats.vertices = firstSampleSize( schema.getPositionsProperty() );
+        stats.faces = firstSampleSize( schema.getFaceCountsProperty() );
+        stats.indices = firstSampleSize( schema.getFaceIndicesProperty() );
+        stats.numSamples = (unsigned int)schema.getPositionsProperty().getNumSamples();
+        stats.hasUVs = schema.getUVsParam().valid();
+
+        // only static meshes can share one expansion
+        stats.geometryKey = geometryKey( object, schema );
+}
+
+void walk( const Abc::IObject& object, std::vector<GpuCacheObjectStats>& objects )
+{
+        for (size_t i = 0; i < object.getNumChildren(); ++i)
+        {
+                Abc::IObject child = object.getChild(i);
+                const AbcA::MetaData& metaData = child.getMetaData();
+
+                GpuCacheObjectStats stats;
+                stats.path = child.getFullName();
+                bool isShape = true;
+
+                if (AbcGeom::IPolyMesh::matches(metaData))
+                {
+                        AbcGeom::IPolyMesh mesh( child, Abc::kWrapExisting );
+                        stats.type = GpuCacheObjectStats::kPolyMesh;
+                        readMeshStats( child, mesh.getSchema(), stats );
+                        stats.hasNormals = mesh.getSchema().getNormalsParam().valid();
+                }
+                else if (AbcGeom::ISubD::matches(metaData))
+                {
+                        AbcGeom::ISubD subd( child, Abc::kWrapExisting );
+                        stats.type = GpuCacheObjectStats::kSubD;
+                        readMeshStats( child, subd.getSchema(), stats );
+                }
+                else if (AbcGeom::IPoints::matches(metaData))
+                {
+                        AbcGeom::IPoints points( child, Abc::kWrapExisting );
+                        stats.type = GpuCacheObjectStats::kPoints;
+                        stats.vertices = firstSampleSize( points.getSchema().getPositionsProperty() );
+                        stats.numSamples = (unsigned int)points.getSchema().getPositionsProperty().getNumSamples();
+                }
+                else if (AbcGeom::ICurves::matches(metaData))
+                {
+                        AbcGeom::ICurves curves( child, Abc::kWrapExisting );
+                        stats.type = GpuCacheObjectStats::kCurves;
+                        stats.vertices = firstSampleSize( curves.getSchema().getPositionsProperty() );
+                        stats.curves = firstSampleSize( curves.getSchema().getNumVerticesProperty() );
+                        stats.numSamples = (unsigned int)curves.getSchema().getPositionsProperty().getNumSamples();
+                        stats.geometryKey = geometryKey( child, curves.getSchema() );
+                }
+                else
+                {
+                        isShape = false;
+                }
+
+                if (isShape)
+                        objects.push_back(stats);
+
+                walk( child, objects );
+        }
+}
+
+bool matchesPattern( const std::string& pattern, const std::string& path )
+{
+        if (fnmatch(pattern.c_str(), path.c_str(), 0) == 0)
+                return true;
+        // also allow patterns written against the object name alone
+        std::string::size_type slash = path.rfind('/');
+        return slash != std::string::npos &&
+               fnmatch(pattern.c_str(), path.c_str() + slash + 1, 0) == 0;
+}
+
+} // namespace
+
+
+std::vector<std::string> GpuCacheSplitLayers( const std::string& layers )
+{
+        static const char* kSpace = " \t\r\n";
+
+        std::vector<std::string> result;
+        std::string::size_type start = 0;
+        while (start <= layers.size())
+        {
+                std::string::size_type end = layers.find(';', start);
+                if (end == std::string::npos)
+                        end = layers.size();
+                std::string layer = layers.substr(start, end - start);
+                std::string::size_type first = layer.find_first_not_of(kSpace);
+                if (first != std::string::npos)
+                        result.push_back(layer.substr(first, layer.find_last_not_of(kSpace) - first + 1));
+                start = end + 1;
+        }
+        return result;
+}
+
+std::shared_ptr<const GpuCacheArchiveIndex> GpuCacheArchiveIndex::Get( const std::string& filename )
+{
+        return Get( std::vector<std::string>(1, filename) );
+}
+
+std::shared_ptr<const GpuCacheArchiveIndex> GpuCacheArchiveIndex::Get( const std::vector<std::string>& layers )
+{
+        struct CacheEntry
+        {
+                std::vector<time_t> modified;
+                std::shared_ptr<const GpuCacheArchiveIndex> index;
+        };
+        static std::map<std::vector<std::string>, CacheEntry> cache;
+
+        std::vector<time_t> modified;
+        bool missing = layers.empty();
+        for (size_t i = 0; i < layers.size(); ++i)
+        {
+                struct stat st;
+                modified.push_back( stat(layers[i].c_str(), &st) == 0 ? st.st_mtime : 0 );
+                missing = missing || modified.back() == 0;
+        }
+
+        std::map<std::vector<std::string>, CacheEntry>::iterator it = cache.find(layers);
+        if (it != cache.end() && it->second.modified == modified)
+                return it->second.index;
+
+        std::shared_ptr<GpuCacheArchiveIndex> index( new GpuCacheArchiveIndex() );
+        if (!missing)
+                index->Build( layers );
+
+        CacheEntry& entry = cache[layers];
+        entry.modified = modified;
+        entry.index = index;
+        return index;
+}
+
+void GpuCacheArchiveIndex::Build( const std::vector<std::string>& layers )
+{
+        try
+        {
+                AbcCoreFactory::IFactory factory;
+                Abc::IArchive archive = layers.size() == 1 ? factory.getArchive( layers[0] )
+                                                           : factory.getArchive( layers );
+                if (!archive.valid())
+                        return;
+
+                walk( archive.getTop(), m_objects );
+                m_valid = true;
+        }
+        catch (const std::exception& e)
+        {
+                GPUCACHE_LOG_WARNING("could not index %s: %s", layers[0].c_str(), e.what());
+                m_objects.clear();
+                m_valid = false;
+        }
+}
+
+void GpuCacheArchiveIndex::Select( const std::string& objectPath,
+                                   const std::string& pattern,
+                                   const std::string& excludePattern,
+                                   std::vector<const GpuCacheObjectStats*>& selected ) const
+{
+        std::string root = objectPath;
+        std::replace( root.begin(), root.end(), '|', '/' );
+        if (root == "/")
+                root.clear();
+
+        for (size_t i = 0; i < m_objects.size(); ++i)
+        {
+                const std::string& path = m_objects[i].path;
+
+                if (!root.empty() &&
+                    path != root &&
+                    path.compare(0, root.size() + 1, root + "/") != 0)
+                        continue;
+                if (!pattern.empty() && pattern != "*" && !matchesPattern(pattern, path))
+                        continue;
+                if (!excludePattern.empty() && matchesPattern(excludePattern, path))
+                        continue;
+
+                selected.push_back( &m_objects[i] );
+        }
+}
@@ -0,0 +1,82 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheArchive.h
+ *
+ *  Lightweight, cached description of the objects in an Alembic archive,
+ *  read from array dimensions only so no geometry is decoded.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+struct GpuCacheObjectStats
+{
+        enum Type
+        {
+                kPolyMesh,
+                kSubD,
+                kPoints,
+                kCurves
+        };
+
+        GpuCacheObjectStats()
+                : type(kPolyMesh), vertices(0), faces(0), indices(0), curves(0),
+                  numSamples(0), hasNormals(false), hasUVs(false)
+        {}
+
+        std::string path;               // full alembic path, "/root/child/shape"
+        Type type;
+        unsigned long long vertices;    // positions in the first sample
+        unsigned long long faces;       // meshes only
+        unsigned long long indices;     // face vertex indices, meshes only
+        unsigned long long curves;      // curves only
+        unsigned int numSamples;        // samples of the positions property
+        bool hasNormals;
+        bool hasUVs;
+
+        /// Every property of the shape's schema (array sample digests, scalar
+        /// values) and its face sets. Objects with the same key have identical
+        /// geometry. Empty for animated objects, or when any property cannot
+        /// be hashed or the archive has no digests.
+        std::string geometryKey;
+};
+
+/// Splits a ';' separated list of archive layers, trimming white space around
+/// each one and dropping empty entries.
+std::vector<std::string> GpuCacheSplitLayers( const std::string& layers );
+
+class GpuCacheArchiveIndex
+{
+public :
+        /// Index of the archive at 'filename'. Indices are cached per file and
+        /// rebuilt when the file's modification time changes. Returns an empty
+        /// index when the archive cannot be opened.
+        static std::shared_ptr<const GpuCacheArchiveIndex> Get( const std::string& filename );
+
+        /// Index of the archives in 'layers' opened as one layered archive,
+        /// the first being the base and each later one overriding those
+        /// before it. Cached like a single file, rebuilt when any layer changes.
+        static std::shared_ptr<const GpuCacheArchiveIndex> Get( const std::vector<std::string>& layers );
+
+        bool IsValid() const { return m_valid; }
+
+        const std::vector<GpuCacheObjectStats>& Objects() const { return m_objects; }
+
+        /// Collects the objects a procedural would expand for the given
+        /// object path ("|" or "/" separated) and include/exclude patterns.
+        void Select( const std::string& objectPath,
+                     const std::string& pattern,
+                     const std::string& excludePattern,
+                     std::vector<const GpuCacheObjectStats*>& selected ) const;
+
+private :
+        GpuCacheArchiveIndex() : m_valid(false) {}
+
+        void Build( const std::vector<std::string>& layers );
+
+        bool m_valid;
+        std::vector<GpuCacheObjectStats> m_objects;
+};
@@ -0,0 +1,303 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheBatching.cpp
+ *
+ *  Scene pre-pass batching gpuCache nodes by archive.
+ */
+
+#include "gpuCacheBatching.h"
+#include "gpuCacheMemory.h"
+#include "gpuCacheLog.h"
+#include "gpuCacheProcedural.h"
+#include "gpuCacheSubdivision.h"
+
+#include <maya/MAnimControl.h>
+#include <maya/MDagPathArray.h>
+#include <maya/MFnDagNode.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MItDag.h>
+#include <maya/MLightLinks.h>
+#include <maya/MMatrix.h>
+#include <maya/MPlug.h>
+#include <maya/MPlugArray.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+
+/// Everything the procedural and the render flags read, except the object
+/// path and the time which are stored per entry.
+const char* kSharedAttributes[] = {
+        "cacheFileName", "cacheLayers", "objectPattern", "excludePattern", "namePrefix",
+        "shutterOpen", "shutterClose", "ai_subDIterations", "ai_subDUVSmoothing",
+        "makeInstance", "flipv", "invertNormals",
+        "shaderAssignation", "displacementAssignation", "shaderAssignmentfile",
+        "overrides", "overridefile", "userAttributes", "userAttributesfile",
+        "skipJson", "skipShaders", "skipDisplacements", "skipOverrides", "skipUserAttributes",
+        "compileOverrides", "assShaders", "radiusPoint", "scaleVelocity", "radiusCurve", "modeCurve",
+        "aiTraceSets", "aiSssSetname", "aiUserOptions",
+        "primaryVisibility", "castsShadows", "receiveShadows", "aiSelfShadows", "aiOpaque", "aiMatte",
+        "aiVisibleInDiffuseReflection", "aiVisibleInSpecularReflection",
+        "aiVisibleInDiffuseTransmission", "aiVisibleInSpecularTransmission",
+        "aiVisibleInVolume", "motionBlur"
+};
+
+std::string plugValue( const MFnDagNode& fnDagNode, const char* name )
+{
+        MPlug plug = fnDagNode.findPlug(name);
+        if (plug.isNull())
+                return std::string();
+        if (plug.attribute().hasFn(MFn::kTypedAttribute))
+                return plug.asString().asChar();
+
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%g", plug.asDouble());
+        return buffer;
+}
+
+/// Name of the shading group of the node's first instance.
+std::string shadingGroup( const MFnDagNode& fnDagNode )
+{
+        MPlug plug = fnDagNode.findPlug("instObjGroups");
+        if (plug.isNull())
+                return std::string();
+
+        MPlugArray connections;
+        plug.elementByLogicalIndex(0).connectedTo(connections, false, true);
+        for (unsigned int i = 0; i < connections.length(); ++i)
+        {
+                if (connections[i].node().hasFn(MFn::kShadingEngine))
+                        return MFnDependencyNode(connections[i].node()).name().asChar();
+        }
+        return std::string();
+}
+
+std::string lightNames( const MDagPathArray& lights )
+{
+        std::vector<std::string> names;
+        for (unsigned int i = 0; i < lights.length(); ++i)
+                names.push_back(lights[i].fullPathName().asChar());
+        std::sort(names.begin(), names.end());
+
+        std::string result;
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+                result += names[i];
+                result += ';';
+        }
+        return result;
+}
+
+/// Nodes with the same key can be exported by one procedural.
+std::string batchKey( const MFnDagNode& fnDagNode, const MDagPath& dagPath, MLightLinks& lightLinks )
+{
+        std::string key;
+        for (size_t i = 0; i < sizeof(kSharedAttributes) / sizeof(kSharedAttributes[0]); ++i)
+        {
+                key += plugValue( fnDagNode, kSharedAttributes[i] );
+                key += '\n';
+        }
+        key += shadingGroup( fnDagNode );
+        key += '\n';
+
+        MDagPathArray lights;
+        lightLinks.getLinkedLights( dagPath, MObject::kNullObj, lights );
+        key += lightNames( lights );
+        key += '\n';
+        lights.clear();
+        lightLinks.getShadowLinkedLights( dagPath, MObject::kNullObj, lights );
+        key += lightNames( lights );
+        return key;
+}
+
+bool plugBool( const MFnDagNode& fnDagNode, const char* name )
+{
+        MPlug plug = fnDagNode.findPlug(name);
+        return !plug.isNull() && plug.asBool();
+}
+
+float plugFloat( const MFnDagNode& fnDagNode, const char* name )
+{
+        MPlug plug = fnDagNode.findPlug(name);
+        return plug.isNull() ? 0.0f : plug.asFloat();
+}
+
+} // namespace
+
+
+AtMatrix GpuCacheBatchEntry::WorldMatrix() const
+{
+        MMatrix m = dagPath.inclusiveMatrix();
+        AtMatrix result;
+        for (int i = 0; i < 4; ++i)
+                for (int j = 0; j < 4; ++j)
+                        result[i][j] = float(m[i][j]);
+        return result;
+}
+
+
+GpuCacheBatches& GpuCacheBatches::Get( const std::vector<double>& motionFrames )
+{
+        // one pass per render: a new session or a new frame starts over with
+        // fresh batches, the translators of the last render keep their own
+        static GpuCacheBatches batches;
+        static double frame = 0.0;
+
+        double currentFrame = MAnimControl::currentTime().as(MTime::uiUnit());
+        if (GpuCacheFirstInSession( "gpucache_batches" ) || frame != currentFrame)
+        {
+                frame = currentFrame;
+
+                batches = GpuCacheBatches();
+                batches.Scan( motionFrames );
+        }
+        return batches;
+}
+
+std::shared_ptr<GpuCacheBatch> GpuCacheBatches::Find( const MDagPath& dagPath, size_t& entry ) const
+{
+        std::map<std::string, std::pair<size_t, size_t> >::const_iterator it =
+                m_nodes.find( dagPath.fullPathName().asChar() );
+        if (it == m_nodes.end())
+                return std::shared_ptr<GpuCacheBatch>();
+
+        entry = it->second.second;
+        return m_batches[it->second.first];
+}
+
+void GpuCacheBatches::Scan( const std::vector<double>& motionFrames )
+{
+        size_t maxEntries = 256;
+        const char* size = getenv("GPUCACHE_BATCH_SIZE");
+        if (size && atoi(size) > 1)
+                maxEntries = (size_t)atoi(size);
+
+        const bool supported = GpuCacheProceduralSupports( "batch" );
+        size_t requested = 0;
+
+        const GpuCacheBudget& budget = GpuCacheBudget::Get( (unsigned int)motionFrames.size() );
+        const std::vector<double> currentFrame( 1, MAnimControl::currentTime().as(MTime::uiUnit()) );
+
+        MLightLinks lightLinks;
+        lightLinks.parseLinks( MObject::kNullObj );
+
+        std::map<std::string, std::vector<GpuCacheBatchEntry> > groups;
+        for (MItDag it(MItDag::kDepthFirst, MFn::kPluginShape); !it.isDone(); it.next())
+        {
+                MDagPath dagPath;
+                it.getPath(dagPath);
+                MFnDagNode fnDagNode( dagPath );
+                if (fnDagNode.typeName() != "gpuCache" ||
+                    fnDagNode.isIntermediateObject() ||
+                    !dagPath.isVisible() ||
+                    !plugBool( fnDagNode, "batchByArchive" ))
+                        continue;
+
+                // without -batch support every node keeps its own procedural
+                ++requested;
+                if (!supported)
+                        continue;
+
+                // per node subdivision, ginstances and budgets need their own procedural
+                if (dagPath.isInstanced() ||
+                    plugBool( fnDagNode, "subDAdaptive" ) ||
+                    plugFloat( fnDagNode, "memoryBudget" ) > 0.0f)
+                        continue;
+                const GpuCacheBudget::Node* budgetNode = budget.Find( dagPath );
+                if (budgetNode && budgetNode->action != GpuCacheBudget::kKeep)
+                        continue;
+
+                GpuCacheBatchEntry entry;
+                entry.dagPath = dagPath;
+                std::string objectPath = plugValue( fnDagNode, "cacheGeomPath" );
+                std::replace( objectPath.begin(), objectPath.end(), '|', '/' );
+                entry.objectPath = objectPath.empty() ? "/" : objectPath;
+                entry.time = plugFloat( fnDagNode, "frame" ) + plugFloat( fnDagNode, "timeOffset" );
+
+                // the procedural's box must hold the entry over the whole shutter
+                const std::vector<double>& frames = plugBool( fnDagNode, "motionBlur" ) ? motionFrames : currentFrame;
+                const MBoundingBox local = fnDagNode.boundingBox();
+                for (size_t f = 0; f < frames.size(); ++f)
+                {
+                        MBoundingBox bound = local;
+                        bound.transformUsing( GpuCacheWorldMatrixAt( dagPath, frames[f] ) );
+                        entry.bound.expand( bound );
+                }
+
+                groups[batchKey( fnDagNode, dagPath, lightLinks )].push_back(entry);
+        }
+
+        if (!supported)
+        {
+                if (requested > 0)
+                        GPUCACHE_LOG_WARNING("the alembic_loader procedural does not read -batch, "
+                                             "exporting %d batchByArchive gpuCache nodes one procedural each",
+                                             (int)requested);
+                return;
+        }
+
+        size_t batched = 0;
+        std::map<std::string, std::vector<GpuCacheBatchEntry> >::iterator group;
+        for (group = groups.begin(); group != groups.end(); ++group)
+        {
+                if (group->second.size() < 2)
+                        continue;
+                Split( group->second, 0, group->second.size(), maxEntries );
+        }
+        for (size_t i = 0; i < m_batches.size(); ++i)
+        {
+                const std::vector<GpuCacheBatchEntry>& entries = m_batches[i]->entries;
+                for (size_t j = 0; j < entries.size(); ++j)
+                        m_nodes[entries[j].dagPath.fullPathName().asChar()] = std::make_pair(i, j);
+                batched += entries.size();
+        }
+
+        if (batched > 0)
+                GPUCACHE_LOG_INFO("batching %d gpuCache nodes into at most %d procedurals",
+                                  (int)batched, (int)m_batches.size());
+}
+
+/// Median splits along the longest axis of the entries' centers until each
+/// cluster fits, so a batch's bounds stay tight enough for culling.
+void GpuCacheBatches::Split( std::vector<GpuCacheBatchEntry>& entries, size_t begin, size_t end, size_t maxEntries )
+{
+        if (end - begin < 2)
+                return;
+
+        if (end - begin <= maxEntries)
+        {
+                std::shared_ptr<GpuCacheBatch> batch( new GpuCacheBatch() );
+                batch->entries.assign( entries.begin() + begin, entries.begin() + end );
+                m_batches.push_back(batch);
+                return;
+        }
+
+        MBoundingBox centers;
+        for (size_t i = begin; i < end; ++i)
+                centers.expand( entries[i].bound.center() );
+
+        int axis = 0;
+        if (centers.height() > centers.width())
+                axis = 1;
+        if (centers.depth() > (axis == 0 ? centers.width() : centers.height()))
+                axis = 2;
+
+        struct CenterLess
+        {
+                int axis;
+                bool operator()( const GpuCacheBatchEntry& a, const GpuCacheBatchEntry& b ) const
+                {
+                        return a.bound.center()[axis] < b.bound.center()[axis];
+                }
+        };
+        CenterLess less = { axis };
+
+        size_t middle = begin + (end - begin) / 2;
+        std::nth_element( entries.begin() + begin, entries.begin() + middle, entries.begin() + end, less );
+
+        Split( entries, begin, middle, maxEntries );
+        Split( entries, middle, end, maxEntries );
+}
@@ -0,0 +1,81 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheBatching.h
+ *
+ *  Grouping of gpuCache nodes that read the same archive with the same look
+ *  into batches, each exported as a single alembic_loader procedural.
+ */
+
+#pragma once
+
+#include <ai.h>
+
+#include <maya/MBoundingBox.h>
+#include <maya/MDagPath.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// One gpuCache node that can be folded into a batch.
+struct GpuCacheBatchEntry
+{
+        GpuCacheBatchEntry() : time(0.0f) {}
+
+        /// World matrix of the node at the current Maya time, which is the
+        /// time of the motion step being exported.
+        AtMatrix WorldMatrix() const;
+
+        MDagPath dagPath;
+        std::string objectPath;         // "/" separated, "/" for the whole archive
+        float time;                     // frame + timeOffset
+        MBoundingBox bound;             // world space, over the node's motion frames
+};
+
+/// Nodes that may share a procedural. Which of them MtoA exports depends on
+/// the render layer, export selection and the like, so the batch is filled
+/// at export: the first member exported creates the procedural and leads,
+/// and every member exported, the leader included, appends itself to it.
+/// Members MtoA skips are never appended and stay out of the render.
+struct GpuCacheBatch
+{
+        GpuCacheBatch() : procedural(NULL), count(0) {}
+
+        std::vector<GpuCacheBatchEntry> entries;
+        AtNode* procedural;             // the leader's alembic_loader, NULL until created
+        unsigned int count;             // members appended to the procedural so far
+};
+
+/// Batches of the gpuCache nodes with batchByArchive on, computed once per
+/// export session and frame like GpuCacheBudget, so a new session never
+/// sees the procedurals of the previous one. Nodes only share a batch when they
+/// read the same archive and layers with the same procedural settings,
+/// shading group, render flags and light / shadow links, so the leader's
+/// visibility, shader and light linking hold for every entry. Instanced,
+/// adaptively subdivided and budgeted nodes are left alone. Each group is
+/// split spatially into clusters of at most GPUCACHE_BATCH_SIZE entries
+/// (256 by default); clusters of a single node are not batched. Nothing is
+/// batched when the alembic_loader procedural does not handle -batch, every
+/// node then exports its own procedural.
+class GpuCacheBatches
+{
+public :
+        /// 'motionFrames' are the session's object motion blur frames, just
+        /// the current frame without object blur.
+        static GpuCacheBatches& Get( const std::vector<double>& motionFrames );
+
+        /// Batch the node with full path 'dagPath' may join and its index in
+        /// the batch's entries, NULL when it is exported on its own.
+        std::shared_ptr<GpuCacheBatch> Find( const MDagPath& dagPath, size_t& entry ) const;
+
+private :
+        GpuCacheBatches() {}
+
+        void Scan( const std::vector<double>& motionFrames );
+        void Split( std::vector<GpuCacheBatchEntry>& entries, size_t begin, size_t end, size_t maxEntries );
+
+        /// Shared with the translators, which keep their batch across a rescan.
+        std::vector<std::shared_ptr<GpuCacheBatch> > m_batches;
+        std::map<std::string, std::pair<size_t, size_t> > m_nodes;  // full path -> batch, entry
+};
@@ -0,0 +1,369 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheBuffers.cpp
+ *
+ *  Conversion of in-memory gpuCache geometry into Arnold shape nodes.
+ */
+
+#include "gpuCacheBuffers.h"
+
+#include <sys/stat.h>
+
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+
+#ifdef GPUCACHE_DEVKIT
+#include <maya/MDGMessage.h>
+#include <maya/MFnAttribute.h>
+#include <maya/MFnDagNode.h>
+#include <maya/MNodeMessage.h>
+#include <maya/MObjectHandle.h>
+#include <maya/MPlug.h>
+
+// Headers from the gpuCache sample in the Maya devkit. They are only found
+// when the build points GPUCACHE_DEVKIT_INCLUDE_PATH at them.
+#include <gpuCacheShapeNode.h>
+#include <gpuCacheGeometry.h>
+#include <gpuCacheSample.h>
+#endif
+
+
+const char* GpuCacheBuffersNodeType( const GpuCacheBuffers& buffers )
+{
+        switch (buffers.kind)
+        {
+          case GpuCacheBuffers::kPoints:
+            return "points";
+          case GpuCacheBuffers::kCurves:
+            return "curves";
+          default :
+            return "polymesh";
+        }
+}
+
+bool GpuCacheExportBuffers( const GpuCacheBuffers& buffers, AtNode* node )
+{
+        // check everything first, a half filled node is worse than none
+        if (buffers.positions == NULL || buffers.numVertices == 0)
+                return false;
+
+        unsigned int numIndices = 0;
+        if (buffers.kind == GpuCacheBuffers::kPolymesh)
+        {
+                for (size_t i = 0; i < buffers.indexRanges.size(); ++i)
+                {
+                        if (buffers.indexRanges[i].indices == NULL && buffers.indexRanges[i].numIndices > 0)
+                                return false;
+                        numIndices += buffers.indexRanges[i].numIndices;
+                }
+                if (numIndices == 0)
+                        return false;
+        }
+        else if (buffers.kind == GpuCacheBuffers::kCurves)
+        {
+                if (buffers.counts == NULL || buffers.numCounts == 0)
+                        return false;
+        }
+
+        // AiArrayConvert copies the whole block in one go, the layouts already
+        // match Arnold's (packed float triples / pairs, 32 bit indices).
+        AtArray* points = AiArrayConvert( buffers.numVertices, 1, AI_TYPE_VECTOR, buffers.positions );
+
+        if (buffers.kind == GpuCacheBuffers::kPolymesh)
+        {
+                // the face groups are copied straight into the one index array
+                AtArray* vidxs = AiArrayAllocate( numIndices, 1, AI_TYPE_UINT );
+                unsigned int* data = (unsigned int*)AiArrayMap( vidxs );
+                for (size_t i = 0; i < buffers.indexRanges.size(); ++i)
+                {
+                        const GpuCacheBuffers::IndexRange& range = buffers.indexRanges[i];
+                        if (range.numIndices > 0)
+                                memcpy( data, range.indices, range.numIndices * sizeof(unsigned int) );
+                        data += range.numIndices;
+                }
+                AiArrayUnmap( vidxs );
+
+                AiNodeSetArray( node, "vlist", points );
+                // an empty nsides array means every face is a triangle
+                if (buffers.counts != NULL)
+                        AiNodeSetArray( node, "nsides", AiArrayConvert( buffers.numCounts, 1, AI_TYPE_UINT, buffers.counts ) );
+
+                // normals and uvs are stored per vertex, so they share the vertex indices
+                if (buffers.normals != NULL)
+                {
+                        AiNodeSetArray( node, "nlist", AiArrayConvert( buffers.numVertices, 1, AI_TYPE_VECTOR, buffers.normals ) );
+                        AiNodeSetArray( node, "nidxs", AiArrayCopy(vidxs) );
+                }
+                if (buffers.uvs != NULL)
+                {
+                        AiNodeSetArray( node, "uvlist", AiArrayConvert( buffers.numVertices, 1, AI_TYPE_VECTOR2, buffers.uvs ) );
+                        AiNodeSetArray( node, "uvidxs", AiArrayCopy(vidxs) );
+                }
+                AiNodeSetArray( node, "vidxs", vidxs );
+        }
+        else
+        {
+                AiNodeSetArray( node, "points", points );
+
+                if (buffers.kind == GpuCacheBuffers::kCurves)
+                {
+                        AiNodeSetArray( node, "num_points", AiArrayConvert( buffers.numCounts, 1, AI_TYPE_UINT, buffers.counts ) );
+                        AiNodeSetStr( node, "basis", "linear" );
+                }
+
+                if (buffers.radius != NULL)
+                        AiNodeSetArray( node, "radius", AiArrayConvert( buffers.numVertices, 1, AI_TYPE_FLOAT, buffers.radius ) );
+        }
+
+        return true;
+}
+
+
+#ifdef GPUCACHE_DEVKIT
+
+namespace
+{
+
+time_t fileModificationTime( const MString& path )
+{
+        struct stat st;
+        if (stat(path.asChar(), &st) != 0)
+                return 0;
+        return st.st_mtime;
+}
+
+/// Wall clock time at which Maya last (re)read each gpuCache node's archive:
+/// when the node was created or its cacheFileName set. Keyed by handle, as
+/// node uuids are only restored after creation while a scene is read.
+struct LoadRecord
+{
+        MObjectHandle node;
+        MCallbackId callback;
+        time_t loaded;
+};
+
+std::unordered_multimap<unsigned int, LoadRecord> loadRecords;
+MCallbackId nodeAddedCallback = 0;
+MCallbackId nodeRemovedCallback = 0;
+bool tracking = false;
+
+LoadRecord* findLoad( const MObject& node )
+{
+        MObjectHandle handle( node );
+        std::pair<std::unordered_multimap<unsigned int, LoadRecord>::iterator,
+                  std::unordered_multimap<unsigned int, LoadRecord>::iterator> range =
+                loadRecords.equal_range( handle.hashCode() );
+        for (std::unordered_multimap<unsigned int, LoadRecord>::iterator it = range.first; it != range.second; ++it)
+        {
+                if (it->second.node == handle)
+                        return &it->second;
+        }
+        return NULL;
+}
+
+void cacheFileChanged( MNodeMessage::AttributeMessage msg, MPlug& plug, MPlug&, void* )
+{
+        if (!(msg & MNodeMessage::kAttributeSet) ||
+            MFnAttribute(plug.attribute()).name() != "cacheFileName")
+                return;
+        LoadRecord* record = findLoad( plug.node() );
+        if (record)
+                record->loaded = time(NULL);
+}
+
+void gpuCacheAdded( MObject& node, void* )
+{
+        LoadRecord record;
+        record.node = MObjectHandle( node );
+        record.callback = MNodeMessage::addAttributeChangedCallback( node, cacheFileChanged );
+        record.loaded = time(NULL);
+        loadRecords.insert( std::make_pair(record.node.hashCode(), record) );
+}
+
+void gpuCacheRemoved( MObject& node, void* )
+{
+        MObjectHandle handle( node );
+        std::pair<std::unordered_multimap<unsigned int, LoadRecord>::iterator,
+                  std::unordered_multimap<unsigned int, LoadRecord>::iterator> range =
+                loadRecords.equal_range( handle.hashCode() );
+        for (std::unordered_multimap<unsigned int, LoadRecord>::iterator it = range.first; it != range.second; ++it)
+        {
+                if (it->second.node == handle)
+                {
+                        MMessage::removeCallback( it->second.callback );
+                        loadRecords.erase( it );
+                        return;
+                }
+        }
+}
+
+AtMatrix toAtMatrix( const MMatrix& m )
+{
+        AtMatrix result;
+        for (int i = 0; i < 4; ++i)
+                for (int j = 0; j < 4; ++j)
+                        result[i][j] = float(m[i][j]);
+        return result;
+}
+
+/// Adapter over the hierarchy the gpuCache node keeps for viewport drawing.
+/// Only polygon meshes live there; they are stored triangulated with per
+/// vertex normals and uvs.
+class GpuCacheNodeSource : public GpuCacheGeometrySource
+{
+public :
+        GpuCacheNodeSource( const GPUCache::SubNode::Ptr& root,
+                            double seconds,
+                            bool stale )
+                : m_root(root), m_seconds(seconds), m_stale(stale)
+        {}
+
+        virtual bool IsAvailable() const
+        {
+                return m_root && !m_stale;
+        }
+
+        virtual void GetBuffers( std::vector<GpuCacheBuffers>& buffers ) const
+        {
+                if (m_root)
+                        collect( m_root, MMatrix::identity, buffers );
+        }
+
+private :
+        void collect( const GPUCache::SubNode::Ptr& subNode,
+                      const MMatrix& parentMatrix,
+                      std::vector<GpuCacheBuffers>& buffers ) const
+        {
+                MMatrix matrix = parentMatrix;
+
+                const GPUCache::XformData* xform =
+                        dynamic_cast<const GPUCache::XformData*>(subNode->getData().get());
+                if (xform)
+                {
+                        const std::shared_ptr<const GPUCache::XformSample>& sample = xform->getSample(m_seconds);
+                        if (sample)
+                        {
+                                if (!sample->visibility())
+                                        return;
+                                matrix = sample->xform() * parentMatrix;
+                        }
+                }
+
+                const GPUCache::ShapeData* shape =
+                        dynamic_cast<const GPUCache::ShapeData*>(subNode->getData().get());
+                if (shape)
+                {
+                        const std::shared_ptr<const GPUCache::ShapeSample>& sample = shape->getSample(m_seconds);
+                        if (sample && sample->visibility() && sample->numTriangles() > 0 &&
+                            sample->positions() && sample->numIndexGroups() > 0)
+                        {
+                                static_assert(sizeof(GPUCache::IndexBuffer::index_t) == sizeof(unsigned int),
+                                              "gpuCache index buffers must be 32 bit to be shared");
+
+                                GpuCacheBuffers buffer;
+                                buffer.kind = GpuCacheBuffers::kPolymesh;
+                                buffer.name = subNode->getName().asChar();
+                                buffer.localMatrix = toAtMatrix(matrix);
+                                buffer.numVertices = (unsigned int)sample->numVerts();
+                                buffer.positions = sample->positions()->data();
+                                if (sample->normals())
+                                        buffer.normals = sample->normals()->data();
+                                if (sample->uvs())
+                                        buffer.uvs = sample->uvs()->data();
+                                // one index buffer per face group, all shared as is
+                                unsigned int numIndices = 0;
+                                for (size_t g = 0; g < sample->numIndexGroups(); ++g)
+                                {
+                                        const std::shared_ptr<const GPUCache::IndexBuffer>& indices = sample->triangleVertIndices(g);
+                                        if (!indices || indices->numIndices() == 0)
+                                                continue;
+                                        buffer.indexRanges.push_back( GpuCacheBuffers::IndexRange(
+                                                (const unsigned int*)indices->data(), (unsigned int)indices->numIndices() ) );
+                                        numIndices += (unsigned int)indices->numIndices();
+                                }
+                                buffer.owner = sample;
+                                if (numIndices > 0)
+                                        buffers.push_back(buffer);
+                        }
+                }
+
+                const std::vector<GPUCache::SubNode::Ptr>& children = subNode->getChildren();
+                for (size_t i = 0; i < children.size(); ++i)
+                        collect( children[i], matrix, buffers );
+        }
+
+        GPUCache::SubNode::Ptr m_root;
+        double m_seconds;
+        bool m_stale;
+};
+
+} // namespace
+
+std::unique_ptr<GpuCacheGeometrySource> GpuCacheGeometrySource::FromGpuCacheNode( const MDagPath& dagPath,
+                                                                                  const MTime& time )
+{
+        MFnDagNode fnDagNode( dagPath );
+        // Checked by type name rather than dynamic_cast, which would need the
+        // type info of gpuCache.so. The shape's own symbols still have to be
+        // visible, which is the default for the Linux build of the plugin.
+        if (fnDagNode.typeName() != "gpuCache" || fnDagNode.userNode() == NULL)
+                return std::unique_ptr<GpuCacheGeometrySource>();
+        GPUCache::ShapeNode* shapeNode = static_cast<GPUCache::ShapeNode*>(fnDagNode.userNode());
+
+        const GPUCache::SubNode::Ptr& root = shapeNode->getCachedGeometry();
+        if (!root)
+                return std::unique_ptr<GpuCacheGeometrySource>();
+
+        // The cache is stale when the file changed on disk after Maya read it.
+        // Nodes loaded before tracking started have no load time, so their
+        // age is unknown and they are treated as stale too.
+        const LoadRecord* record = findLoad( dagPath.node() );
+        MString cacheFile = fnDagNode.findPlug("cacheFileName").asString().expandEnvironmentVariablesAndTilde();
+        time_t fileTime = fileModificationTime(cacheFile);
+        bool stale = record == NULL || fileTime == 0 || fileTime >= record->loaded;
+
+        return std::unique_ptr<GpuCacheGeometrySource>(
+                new GpuCacheNodeSource( root, time.as(MTime::kSeconds), stale ) );
+}
+
+void GpuCacheGeometrySource::StartTracking()
+{
+        if (tracking)
+                return;
+        nodeAddedCallback = MDGMessage::addNodeAddedCallback( gpuCacheAdded, "gpuCache" );
+        nodeRemovedCallback = MDGMessage::addNodeRemovedCallback( gpuCacheRemoved, "gpuCache" );
+        tracking = true;
+}
+
+void GpuCacheGeometrySource::StopTracking()
+{
+        if (!tracking)
+                return;
+        MMessage::removeCallback( nodeAddedCallback );
+        MMessage::removeCallback( nodeRemovedCallback );
+        for (std::unordered_multimap<unsigned int, LoadRecord>::iterator it = loadRecords.begin(); it != loadRecords.end(); ++it)
+                MMessage::removeCallback( it->second.callback );
+        loadRecords.clear();
+        tracking = false;
+}
+
+#else
+
+void GpuCacheGeometrySource::StartTracking()
+{
+}
+
+void GpuCacheGeometrySource::StopTracking()
+{
+}
+
+std::unique_ptr<GpuCacheGeometrySource> GpuCacheGeometrySource::FromGpuCacheNode( const MDagPath&,
+                                                                                  const MTime& )
+{
+        // Built without the gpuCache devkit headers: the in-memory geometry
+        // cannot be reached, so the Alembic archive is always used.
+        return std::unique_ptr<GpuCacheGeometrySource>();
+}
+
+#endif
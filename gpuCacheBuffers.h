@@ -0,0 +1,100 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheBuffers.h
+ *
+ *  Geometry buffers already held in memory by a gpuCache node, and the
+ *  conversion of those buffers into Arnold shape nodes.
+ */
+
+#pragma once
+
+#include <ai.h>
+#include <maya/MDagPath.h>
+#include <maya/MTime.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/// One shape worth of flat, per-vertex arrays. The pointers reference memory
+/// owned by whoever produced the buffers; 'owner' keeps that memory alive for
+/// as long as the buffers are in use so nothing has to be copied up front.
+struct GpuCacheBuffers
+{
+        enum Kind
+        {
+                kPolymesh,
+                kPoints,
+                kCurves
+        };
+
+        /// A run of polymesh vertex indices, one per face group. The runs are
+        /// exported one after the other as a single face list.
+        struct IndexRange
+        {
+                IndexRange( const unsigned int* i = NULL, unsigned int n = 0 ) : indices(i), numIndices(n) {}
+
+                const unsigned int* indices;
+                unsigned int numIndices;
+        };
+
+        GpuCacheBuffers()
+                : kind(kPolymesh),
+                  localMatrix(AiM4Identity()),
+                  positions(NULL), normals(NULL), uvs(NULL), radius(NULL),
+                  numVertices(0),
+                  counts(NULL), numCounts(0)
+        {}
+
+        Kind kind;
+        std::string name;
+        AtMatrix localMatrix;
+
+        const float* positions;         // numVertices * 3
+        const float* normals;           // numVertices * 3, optional
+        const float* uvs;               // numVertices * 2, optional
+        const float* radius;            // numVertices, points/curves only, optional
+        unsigned int numVertices;
+
+        std::vector<IndexRange> indexRanges;    // polymesh vertex indices
+
+        const unsigned int* counts;     // polymesh nsides (NULL means triangles) or curve num_points
+        unsigned int numCounts;
+
+        std::shared_ptr<const void> owner;
+};
+
+/// Where the in-memory geometry comes from. The translator only talks to this
+/// interface, so the conversion can be driven by synthetic buffers as well as
+/// by the data a gpuCache node keeps for the viewport.
+class GpuCacheGeometrySource
+{
+public :
+        virtual ~GpuCacheGeometrySource() {}
+
+        /// False when the source has no data, or the data no longer matches
+        /// the file on disk. Callers must then read the Alembic archive.
+        virtual bool IsAvailable() const = 0;
+
+        virtual void GetBuffers( std::vector<GpuCacheBuffers>& buffers ) const = 0;
+
+        /// Returns the geometry held by the gpuCache node at 'dagPath' for the
+        /// given time, or NULL if it cannot be accessed from this build.
+        static std::unique_ptr<GpuCacheGeometrySource> FromGpuCacheNode( const MDagPath& dagPath,
+                                                                         const MTime& time );
+
+        /// Records when Maya (re)reads each gpuCache node's archive, so
+        /// FromGpuCacheNode can tell cached data from a newer file on disk.
+        /// Started when the extension loads; nodes created before then are
+        /// never exported from memory.
+        static void StartTracking();
+        static void StopTracking();
+};
+
+/// Arnold node type matching the buffer kind.
+const char* GpuCacheBuffersNodeType( const GpuCacheBuffers& buffers );
+
+/// Fills the geometry parameters of 'node' from 'buffers' with one bulk copy
+/// per array. Returns false, leaving 'node' untouched, if the buffers are
+/// incomplete.
+bool GpuCacheExportBuffers( const GpuCacheBuffers& buffers, AtNode* node );
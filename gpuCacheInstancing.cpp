@@ -0,0 +1,51 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheInstancing.cpp
+ *
+ *  Duplicate geometry detection for automatic instancing.
+ */
+
+#include "gpuCacheInstancing.h"
+#include "gpuCacheArchive.h"
+
+#include <map>
+
+GpuCacheInstanceGroups GpuCacheFindInstances( const GpuCacheMemoryParams& params )
+{
+        GpuCacheInstanceGroups result;
+
+        std::shared_ptr<const GpuCacheArchiveIndex> index = GpuCacheArchiveIndex::Get( params.Archives() );
+        if (!index->IsValid())
+                return result;
+
+        std::vector<const GpuCacheObjectStats*> selected;
+        index->Select( params.objectPath, params.pattern, params.excludePattern, selected );
+
+        std::map<std::string, std::vector<const GpuCacheObjectStats*> > byGeometry;
+        for (size_t i = 0; i < selected.size(); ++i)
+        {
+                if (selected[i]->geometryKey.empty())
+                        ++result.uniqueShapes;
+                else
+                        byGeometry[selected[i]->geometryKey].push_back(selected[i]);
+        }
+
+        std::map<std::string, std::vector<const GpuCacheObjectStats*> >::const_iterator it;
+        for (it = byGeometry.begin(); it != byGeometry.end(); ++it)
+        {
+                const std::vector<const GpuCacheObjectStats*>& objects = it->second;
+                ++result.uniqueShapes;
+                if (objects.size() < 2)
+                        continue;
+
+                result.instances += (unsigned int)objects.size() - 1;
+                result.savedBytes += (objects.size() - 1) *
+                        GpuCacheObjectMemory( *objects[0], params.subDIterations, params.motionKeys );
+
+                std::vector<std::string> group;
+                for (size_t i = 0; i < objects.size(); ++i)
+                        group.push_back(objects[i]->path);
+                result.groups.push_back(group);
+        }
+        return result;
+}
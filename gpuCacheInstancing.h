@@ -0,0 +1,30 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheInstancing.h
+ *
+ *  Detection of duplicate geometry inside an archive, from the sample
+ *  digests Alembic stores, to decide when instanced expansion pays off.
+ */
+
+#pragma once
+
+#include "gpuCacheMemory.h"
+
+#include <string>
+#include <vector>
+
+struct GpuCacheInstanceGroups
+{
+        GpuCacheInstanceGroups() : uniqueShapes(0), instances(0), savedBytes(0) {}
+
+        unsigned int uniqueShapes;      // distinct geometries among the selected objects
+        unsigned int instances;         // objects that could reuse another one's geometry
+        unsigned long long savedBytes;  // forecast saving of expanding them as instances
+
+        /// Alembic paths sharing one geometry, only groups of two or more.
+        std::vector<std::vector<std::string> > groups;
+};
+
+/// Groups the objects 'params' selects by geometry. Objects without a
+/// geometry key (animated, or archives without digests) count as unique.
+GpuCacheInstanceGroups GpuCacheFindInstances( const GpuCacheMemoryParams& params );
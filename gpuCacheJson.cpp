@@ -0,0 +1,218 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheJson.cpp
+ *
+ *  Minimal JSON reader.
+ */
+
+#include "gpuCacheJson.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+class GpuCacheJsonParser
+{
+public :
+        GpuCacheJsonParser( const std::string& text ) : m_text(text), m_pos(0) {}
+
+        bool ParseDocument( GpuCacheJsonValue& value )
+        {
+                if (!parseValue(value))
+                        return false;
+                skipSpace();
+                if (m_pos != m_text.size())
+                        return fail("trailing characters");
+                return true;
+        }
+
+        const std::string& Error() const { return m_error; }
+
+private :
+        bool fail( const char* what )
+        {
+                char buffer[128];
+                snprintf(buffer, sizeof(buffer), "%s at offset %lu", what, (unsigned long)m_pos);
+                m_error = buffer;
+                return false;
+        }
+
+        void skipSpace()
+        {
+                while (m_pos < m_text.size() && strchr(" \t\r\n", m_text[m_pos]))
+                        ++m_pos;
+        }
+
+        bool consume( const char* literal )
+        {
+                size_t length = strlen(literal);
+                if (m_text.compare(m_pos, length, literal) != 0)
+                        return false;
+                m_pos += length;
+                return true;
+        }
+
+        bool parseValue( GpuCacheJsonValue& value )
+        {
+                skipSpace();
+                if (m_pos >= m_text.size())
+                        return fail("unexpected end of input");
+
+                const char c = m_text[m_pos];
+                if (c == '{')
+                        return parseObject(value);
+                if (c == '[')
+                        return parseArray(value);
+                if (c == '"')
+                {
+                        value.m_type = GpuCacheJsonValue::kString;
+                        return parseString(value.m_string);
+                }
+                if (consume("true"))
+                {
+                        value.m_type = GpuCacheJsonValue::kBool;
+                        value.m_bool = true;
+                        return true;
+                }
+                if (consume("false"))
+                {
+                        value.m_type = GpuCacheJsonValue::kBool;
+                        value.m_bool = false;
+                        return true;
+                }
+                if (consume("null"))
+                {
+                        value.m_type = GpuCacheJsonValue::kNull;
+                        return true;
+                }
+                return parseNumber(value);
+        }
+
+        bool parseNumber( GpuCacheJsonValue& value )
+        {
+                const char* start = m_text.c_str() + m_pos;
+                char* end = NULL;
+                value.m_number = strtod(start, &end);
+                if (end == start)
+                        return fail("unexpected character");
+                value.m_type = GpuCacheJsonValue::kNumber;
+                value.m_string.assign(start, end - start);
+                m_pos += end - start;
+                return true;
+        }
+
+        bool parseString( std::string& result )
+        {
+                ++m_pos; // opening quote
+                while (m_pos < m_text.size())
+                {
+                        char c = m_text[m_pos++];
+                        if (c == '"')
+                                return true;
+                        if (c != '\\')
+                        {
+                                result += c;
+                                continue;
+                        }
+                        if (m_pos >= m_text.size())
+                                break;
+                        c = m_text[m_pos++];
+                        switch (c)
+                        {
+                          case 'b': result += '\b'; break;
+                          case 'f': result += '\f'; break;
+                          case 'n': result += '\n'; break;
+                          case 'r': result += '\r'; break;
+                          case 't': result += '\t'; break;
+                          case 'u':
+                          {
+                            if (m_pos + 4 > m_text.size())
+                                    return fail("truncated escape");
+                            unsigned long code = strtoul(m_text.substr(m_pos, 4).c_str(), NULL, 16);
+                            m_pos += 4;
+                            // encode as UTF-8, surrogate pairs are passed through as is
+                            if (code < 0x80)
+                                    result += char(code);
+                            else if (code < 0x800)
+                            {
+                                    result += char(0xC0 | (code >> 6));
+                                    result += char(0x80 | (code & 0x3F));
+                            }
+                            else
+                            {
+                                    result += char(0xE0 | (code >> 12));
+                                    result += char(0x80 | ((code >> 6) & 0x3F));
+                                    result += char(0x80 | (code & 0x3F));
+                            }
+                            break;
+                          }
+                          default :
+                            result += c;
+                            break;
+                        }
+                }
+                return fail("unterminated string");
+        }
+
+        bool parseArray( GpuCacheJsonValue& value )
+        {
+                value.m_type = GpuCacheJsonValue::kArray;
+                ++m_pos;
+                skipSpace();
+                if (consume("]"))
+                        return true;
+                while (true)
+                {
+                        value.m_elements.push_back(GpuCacheJsonValue());
+                        if (!parseValue(value.m_elements.back()))
+                                return false;
+                        skipSpace();
+                        if (consume("]"))
+                                return true;
+                        if (!consume(","))
+                                return fail("expected ',' or ']'");
+                }
+        }
+
+        bool parseObject( GpuCacheJsonValue& value )
+        {
+                value.m_type = GpuCacheJsonValue::kObject;
+                ++m_pos;
+                skipSpace();
+                if (consume("}"))
+                        return true;
+                while (true)
+                {
+                        skipSpace();
+                        if (m_pos >= m_text.size() || m_text[m_pos] != '"')
+                                return fail("expected a key");
+                        value.m_members.push_back(std::make_pair(std::string(), GpuCacheJsonValue()));
+                        if (!parseString(value.m_members.back().first))
+                                return false;
+                        skipSpace();
+                        if (!consume(":"))
+                                return fail("expected ':'");
+                        if (!parseValue(value.m_members.back().second))
+                                return false;
+                        skipSpace();
+                        if (consume("}"))
+                                return true;
+                        if (!consume(","))
+                                return fail("expected ',' or '}'");
+                }
+        }
+
+        const std::string& m_text;
+        size_t m_pos;
+        std::string m_error;
+};
+
+bool GpuCacheJsonValue::Parse( const std::string& text, GpuCacheJsonValue& value, std::string& error )
+{
+        value = GpuCacheJsonValue();
+        GpuCacheJsonParser parser( text );
+        if (parser.ParseDocument(value))
+                return true;
+        error = parser.Error();
+        return false;
+}
@@ -0,0 +1,58 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheJson.h
+ *
+ *  Minimal JSON reader for the assignment, override and user attribute
+ *  dictionaries the translator has to look inside of.
+ */
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class GpuCacheJsonValue
+{
+public :
+        enum Type
+        {
+                kNull,
+                kBool,
+                kNumber,
+                kString,
+                kArray,
+                kObject
+        };
+
+        typedef std::vector<std::pair<std::string, GpuCacheJsonValue> > Members;
+
+        GpuCacheJsonValue() : m_type(kNull), m_bool(false), m_number(0.0) {}
+
+        /// Parses 'text'. Returns false and fills 'error' on malformed input.
+        static bool Parse( const std::string& text, GpuCacheJsonValue& value, std::string& error );
+
+        Type GetType() const { return m_type; }
+        bool IsObject() const { return m_type == kObject; }
+
+        bool AsBool() const { return m_bool; }
+        double AsNumber() const { return m_number; }
+        const std::string& AsString() const { return m_string; }
+        const std::vector<GpuCacheJsonValue>& Elements() const { return m_elements; }
+
+        /// Object members, in file order.
+        const Members& GetMembers() const { return m_members; }
+
+        /// Number as written in the file, so "2" stays an integer.
+        const std::string& NumberText() const { return m_string; }
+
+private :
+        friend class GpuCacheJsonParser;
+
+        Type m_type;
+        bool m_bool;
+        double m_number;
+        std::string m_string;
+        std::vector<GpuCacheJsonValue> m_elements;
+        Members m_members;
+};
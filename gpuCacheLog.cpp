@@ -0,0 +1,274 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheLog.cpp
+ *
+ *  Asynchronous, rate limited logging for the translator.
+ */
+
+#include "gpuCacheLog.h"
+
+#include <ai.h>
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+
+const unsigned int kBurstPerSecond = 20;
+const size_t kQueueSize = 4096;           // power of two
+const size_t kMessageSize = 512;
+
+long long nowMilliseconds()
+{
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Bounded multi-producer queue after Dmitry Vyukov's design; each cell
+/// carries a sequence number so producers only contend on one counter.
+/// There is a single consumer, the drain thread (or Flush when no thread
+/// runs), serialised by s_consumerMutex.
+struct Cell
+{
+        std::atomic<size_t> sequence;
+        GpuCacheLogLevel level;
+        char text[kMessageSize];
+};
+
+Cell* s_cells = NULL;
+std::atomic<size_t> s_enqueuePos(0);
+size_t s_dequeuePos = 0;
+std::atomic<size_t> s_drained(0);
+std::atomic<unsigned int> s_dropped(0);
+
+std::atomic<GpuCacheLogSite*> s_sites(NULL);
+
+std::mutex s_threadMutex;
+std::mutex s_consumerMutex;
+std::thread s_thread;
+std::atomic<bool> s_running(false);
+
+void initialiseQueue()
+{
+        if (s_cells)
+                return;
+        s_cells = new Cell[kQueueSize];
+        for (size_t i = 0; i < kQueueSize; ++i)
+                s_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+/// Never waits: with the queue full the message is dropped and counted.
+bool enqueue( GpuCacheLogLevel level, const char* format, va_list args )
+{
+        size_t pos = s_enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true)
+        {
+                cell = &s_cells[pos & (kQueueSize - 1)];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                long long difference = (long long)sequence - (long long)pos;
+                if (difference == 0)
+                {
+                        if (s_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                                break;
+                }
+                else if (difference < 0)
+                {
+                        ++s_dropped;
+                        return false;
+                }
+                else
+                {
+                        pos = s_enqueuePos.load(std::memory_order_relaxed);
+                }
+        }
+
+        cell->level = level;
+        vsnprintf(cell->text, kMessageSize, format, args);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+}
+
+bool enqueue( GpuCacheLogLevel level, const char* format, ... )
+{
+        va_list args;
+        va_start(args, format);
+        bool queued = enqueue(level, format, args);
+        va_end(args);
+        return queued;
+}
+
+void forward( GpuCacheLogLevel level, const char* text )
+{
+        switch (level)
+        {
+          case kGpuCacheLogDebug:
+            AiMsgDebug("[GpuCacheTranslator] %s", text);
+            break;
+          case kGpuCacheLogInfo:
+            AiMsgInfo("[GpuCacheTranslator] %s", text);
+            break;
+          case kGpuCacheLogWarning:
+            AiMsgWarning("[GpuCacheTranslator] %s", text);
+            break;
+          default :
+            AiMsgError("[GpuCacheTranslator] %s", text);
+            break;
+        }
+}
+
+/// Hands everything queued to Arnold. Returns the number of messages.
+size_t drain()
+{
+        std::lock_guard<std::mutex> lock(s_consumerMutex);
+        size_t count = 0;
+        while (true)
+        {
+                Cell& cell = s_cells[s_dequeuePos & (kQueueSize - 1)];
+                if (cell.sequence.load(std::memory_order_acquire) != s_dequeuePos + 1)
+                        break;
+                forward(cell.level, cell.text);
+                cell.sequence.store(s_dequeuePos + kQueueSize, std::memory_order_release);
+                ++s_dequeuePos;
+                ++count;
+        }
+
+        unsigned int dropped = s_dropped.exchange(0);
+        if (dropped > 0)
+                AiMsgWarning("[GpuCacheTranslator] %u log messages dropped, the log queue was full", dropped);
+
+        s_drained.store(s_dequeuePos, std::memory_order_release);
+        return count;
+}
+
+void drainLoop()
+{
+        while (s_running.load(std::memory_order_acquire))
+        {
+                if (drain() == 0)
+                        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+}
+
+void start()
+{
+        std::lock_guard<std::mutex> lock(s_threadMutex);
+        if (s_running.load())
+                return;
+        initialiseQueue();
+        s_running.store(true, std::memory_order_release);
+        s_thread = std::thread(drainLoop);
+}
+
+void queueSummaries()
+{
+        for (GpuCacheLogSite* site = s_sites.load(); site; site = site->Next())
+        {
+                unsigned int suppressed = site->TakeSuppressed();
+                if (suppressed > 0)
+                        enqueue(kGpuCacheLogInfo, "%s:%d: %u similar messages suppressed",
+                                site->File(), site->Line(), suppressed);
+        }
+}
+
+// stop the thread before static destruction gets to it
+struct ShutdownGuard
+{
+        ~ShutdownGuard() { GpuCacheLog::Shutdown(); }
+} s_shutdownGuard;
+
+} // namespace
+
+
+GpuCacheLogSite::GpuCacheLogSite( const char* file, int line, bool limited )
+        : m_file(file), m_line(line), m_limited(limited),
+          m_windowStart(nowMilliseconds()), m_count(0), m_suppressed(0)
+{
+        m_next = s_sites.load();
+        while (!s_sites.compare_exchange_weak(m_next, this))
+                ;
+}
+
+bool GpuCacheLogSite::Allow()
+{
+        if (!m_limited)
+                return true;
+
+        const long long now = nowMilliseconds();
+        long long windowStart = m_windowStart.load(std::memory_order_relaxed);
+        if (now - windowStart >= 1000 &&
+            m_windowStart.compare_exchange_strong(windowStart, now))
+                m_count.store(0, std::memory_order_relaxed);
+
+        if (++m_count <= kBurstPerSecond)
+                return true;
+        ++m_suppressed;
+        return false;
+}
+
+bool GpuCacheLog::Enabled( GpuCacheLogLevel level )
+{
+        const int flags = AiMsgGetConsoleFlags() | AiMsgGetLogFileFlags();
+        switch (level)
+        {
+          case kGpuCacheLogDebug:
+            return (flags & AI_LOG_DEBUG) != 0;
+          case kGpuCacheLogInfo:
+            return (flags & AI_LOG_INFO) != 0;
+          case kGpuCacheLogWarning:
+            return (flags & AI_LOG_WARNINGS) != 0;
+          default :
+            return true;
+        }
+}
+
+void GpuCacheLog::Write( GpuCacheLogSite& site, GpuCacheLogLevel level, const char* format, ... )
+{
+        if (!s_running.load(std::memory_order_acquire))
+                start();
+
+        unsigned int suppressed = site.TakeSuppressed();
+        if (suppressed > 0)
+                enqueue(kGpuCacheLogInfo, "%s:%d: %u similar messages suppressed",
+                        site.File(), site.Line(), suppressed);
+
+        va_list args;
+        va_start(args, format);
+        enqueue(level, format, args);
+        va_end(args);
+}
+
+void GpuCacheLog::Flush()
+{
+        if (s_cells == NULL)
+                return;
+
+        queueSummaries();
+
+        const size_t target = s_enqueuePos.load();
+        if (!s_running.load(std::memory_order_acquire))
+        {
+                drain();
+                return;
+        }
+        while (s_drained.load(std::memory_order_acquire) < target)
+                std::this_thread::yield();
+}
+
+void GpuCacheLog::Shutdown()
+{
+        std::lock_guard<std::mutex> lock(s_threadMutex);
+        if (!s_running.load())
+                return;
+
+        s_running.store(false, std::memory_order_release);
+        if (s_thread.joinable())
+                s_thread.join();
+
+        queueSummaries();
+        drain();
+}
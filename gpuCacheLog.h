@@ -0,0 +1,105 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheLog.h
+ *
+ *  Logging for the translator. Messages are formatted at the call site into
+ *  a lock-free queue and handed to Arnold's message functions by a background
+ *  thread, so exporting never waits on console I/O, not even when the queue
+ *  is full: the message is then dropped and counted. Each call site is rate
+ *  limited and reports how many messages it dropped, except the per node
+ *  debug reports (GPUCACHE_REPORT_DEBUG), which are only rate limited by
+ *  the queue and only written when Arnold logs debug messages.
+ *
+ *  GPUCACHE_LOG_DEBUG compiles to nothing when NDEBUG is defined.
+ */
+
+#pragma once
+
+#include <atomic>
+
+enum GpuCacheLogLevel
+{
+        kGpuCacheLogDebug,
+        kGpuCacheLogInfo,
+        kGpuCacheLogWarning,
+        kGpuCacheLogError
+};
+
+/// Per call site state, one static instance per GPUCACHE_LOG_* expansion.
+class GpuCacheLogSite
+{
+public :
+        GpuCacheLogSite( const char* file, int line, bool limited = true );
+
+        /// True if the site may log now. Limited sites get a burst of
+        /// messages per second, the rest are counted and summarised later.
+        bool Allow();
+
+        const char* File() const { return m_file; }
+        int Line() const { return m_line; }
+
+        /// Returns and resets the number of messages dropped since the last call.
+        unsigned int TakeSuppressed() { return m_suppressed.exchange(0); }
+
+        GpuCacheLogSite* Next() const { return m_next; }
+
+private :
+        const char* m_file;
+        int m_line;
+        bool m_limited;
+        std::atomic<long long> m_windowStart;
+        std::atomic<unsigned int> m_count;
+        std::atomic<unsigned int> m_suppressed;
+        GpuCacheLogSite* m_next;
+};
+
+class GpuCacheLog
+{
+public :
+        /// Whether Arnold's console or log file flags let messages of 'level'
+        /// through.
+        static bool Enabled( GpuCacheLogLevel level );
+
+        static void Write( GpuCacheLogSite& site, GpuCacheLogLevel level, const char* format, ... )
+#ifdef __GNUC__
+                __attribute__((format(printf, 3, 4)))
+#endif
+                ;
+
+        /// Blocks until everything queued so far has been handed to Arnold,
+        /// including the suppression summaries.
+        static void Flush();
+
+        /// Flushes and stops the background thread. Safe to call repeatedly.
+        static void Shutdown();
+};
+
+#define GPUCACHE_LOG( level, ... )                                                      \
+        do                                                                              \
+        {                                                                               \
+                static GpuCacheLogSite gpuCacheLogSite_( __FILE__, __LINE__ );          \
+                if (GpuCacheLog::Enabled(level) && gpuCacheLogSite_.Allow())            \
+                        GpuCacheLog::Write( gpuCacheLogSite_, level, __VA_ARGS__ );     \
+        } while (0)
+
+/// Report lines, one per node. Kept in release builds, but at debug level so
+/// a scene of thousands of nodes does not flood the render log by default.
+#define GPUCACHE_REPORT( level, ... )                                                   \
+        do                                                                              \
+        {                                                                               \
+                static GpuCacheLogSite gpuCacheLogSite_( __FILE__, __LINE__, false );   \
+                if (GpuCacheLog::Enabled(level))                                        \
+                        GpuCacheLog::Write( gpuCacheLogSite_, level, __VA_ARGS__ );     \
+        } while (0)
+
+#ifdef NDEBUG
+#define GPUCACHE_LOG_DEBUG( ... ) do {} while (0)
+#else
+#define GPUCACHE_LOG_DEBUG( ... ) GPUCACHE_LOG( kGpuCacheLogDebug, __VA_ARGS__ )
+#endif
+
+#define GPUCACHE_LOG_INFO( ... ) GPUCACHE_LOG( kGpuCacheLogInfo, __VA_ARGS__ )
+#define GPUCACHE_LOG_WARNING( ... ) GPUCACHE_LOG( kGpuCacheLogWarning, __VA_ARGS__ )
+#define GPUCACHE_LOG_ERROR( ... ) GPUCACHE_LOG( kGpuCacheLogError, __VA_ARGS__ )
+
+#define GPUCACHE_REPORT_DEBUG( ... ) GPUCACHE_REPORT( kGpuCacheLogDebug, __VA_ARGS__ )
@@ -0,0 +1,334 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheMemory.cpp
+ *
+ *  Export-time memory forecast and budget for gpuCache nodes.
+ */
+
+#include "gpuCacheMemory.h"
+#include "gpuCacheArchive.h"
+#include "gpuCacheProcedural.h"
+#include "gpuCacheSubdivision.h"
+#include "gpuCacheLog.h"
+
+#include <ai.h>
+
+#include <maya/MAnimControl.h>
+#include <maya/MFnDagNode.h>
+#include <maya/MItDag.h>
+#include <maya/MPlug.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+// Rough costs of the data Arnold keeps per element, including a share of the
+// acceleration structure per primitive. They only need to rank nodes and
+// give the right order of magnitude.
+const unsigned long long kBytesPerPosition = 12;
+const unsigned long long kBytesPerIndex = 4;
+const unsigned long long kBytesPerUV = 8;
+const unsigned long long kBytesPerRadius = 4;
+const unsigned long long kBytesPerPrimitive = 32;
+const unsigned long long kBytesPerObject = 2048;
+
+unsigned long long objectBytes( const GpuCacheObjectStats& stats,
+                                int subDIterations,
+                                unsigned int motionKeys,
+                                unsigned long long& polygons )
+{
+        const unsigned long long keys = stats.numSamples > 1 ? motionKeys : 1;
+        unsigned long long bytes = kBytesPerObject;
+
+        switch (stats.type)
+        {
+          case GpuCacheObjectStats::kPoints:
+            polygons = 0;
+            bytes += stats.vertices * (kBytesPerPosition * keys + kBytesPerRadius + kBytesPerPrimitive);
+            break;
+
+          case GpuCacheObjectStats::kCurves:
+            polygons = 0;
+            bytes += stats.vertices * (kBytesPerPosition * keys + kBytesPerRadius + kBytesPerPrimitive);
+            bytes += stats.curves * kBytesPerIndex;
+            break;
+
+          default :
+          {
+            unsigned long long vertices = stats.vertices;
+            unsigned long long indices = stats.indices;
+            polygons = stats.faces;
+            bool normals = stats.hasNormals;
+
+            if (subDIterations > 0 && indices > 0)
+            {
+                    // the first iteration splits every n-gon into n quads
+                    polygons = GpuCacheSubdividedPolygons( indices, subDIterations - 1 );
+                    vertices = polygons;
+                    indices = polygons * 4;
+                    normals = true;
+            }
+
+            bytes += vertices * kBytesPerPosition * keys;
+            bytes += indices * kBytesPerIndex + polygons;
+            if (normals)
+                    bytes += vertices * kBytesPerPosition * keys + indices * kBytesPerIndex;
+            if (stats.hasUVs)
+                    bytes += vertices * kBytesPerUV + indices * kBytesPerIndex;
+            bytes += polygons * kBytesPerPrimitive;
+            break;
+          }
+        }
+        return bytes;
+}
+
+std::string plugString( const MFnDagNode& fnDagNode, const char* name )
+{
+        MPlug plug = fnDagNode.findPlug(name);
+        return plug.isNull() ? std::string() : std::string(plug.asString().expandEnvironmentVariablesAndTilde().asChar());
+}
+
+} // namespace
+
+
+std::vector<std::string> GpuCacheMemoryParams::Archives() const
+{
+        std::vector<std::string> archives(1, filename);
+        archives.insert(archives.end(), layers.begin(), layers.end());
+        return archives;
+}
+
+GpuCacheMemoryParams GpuCacheMemoryParams::FromNode( const MDagPath& dagPath, unsigned int motionKeys )
+{
+        MFnDagNode fnDagNode( dagPath );
+        GpuCacheMemoryParams params;
+        params.filename = plugString( fnDagNode, "cacheFileName" );
+        // layers the procedural cannot read are not rendered either
+        if (GpuCacheProceduralSupports( "layers" ))
+                params.layers = GpuCacheSplitLayers( plugString( fnDagNode, "cacheLayers" ) );
+        params.objectPath = plugString( fnDagNode, "cacheGeomPath" );
+        params.pattern = plugString( fnDagNode, "objectPattern" );
+        params.excludePattern = plugString( fnDagNode, "excludePattern" );
+        params.motionKeys = motionKeys;
+
+        MPlug plug = fnDagNode.findPlug("subDAdaptive");
+        if (!plug.isNull() && plug.asBool())
+                plug = fnDagNode.findPlug("subDMaxIterations");
+        else
+                plug = fnDagNode.findPlug("ai_subDIterations");
+        if (!plug.isNull())
+                params.subDIterations = plug.asInt();
+
+        return params;
+}
+
+unsigned long long GpuCacheObjectMemory( const GpuCacheObjectStats& stats,
+                                         int subDIterations,
+                                         unsigned int motionKeys )
+{
+        unsigned long long polygons = 0;
+        return objectBytes( stats, subDIterations, motionKeys, polygons );
+}
+
+GpuCacheMemoryEstimate GpuCacheEstimateMemory( const GpuCacheMemoryParams& params )
+{
+        GpuCacheMemoryEstimate estimate;
+
+        std::shared_ptr<const GpuCacheArchiveIndex> index = GpuCacheArchiveIndex::Get( params.Archives() );
+        if (!index->IsValid())
+                return estimate;
+
+        std::vector<const GpuCacheObjectStats*> selected;
+        index->Select( params.objectPath, params.pattern, params.excludePattern, selected );
+
+        estimate.valid = true;
+        for (size_t i = 0; i < selected.size(); ++i)
+        {
+                unsigned long long polygons = 0;
+                estimate.bytes += objectBytes( *selected[i], params.subDIterations, params.motionKeys, polygons );
+                estimate.polygons += polygons;
+                ++estimate.objects;
+        }
+        return estimate;
+}
+
+std::string GpuCacheFormatBytes( unsigned long long bytes )
+{
+        char buffer[32];
+        if (bytes >= (1ull << 30))
+                snprintf(buffer, sizeof(buffer), "%.2f GB", double(bytes) / double(1ull << 30));
+        else
+                snprintf(buffer, sizeof(buffer), "%.1f MB", double(bytes) / double(1ull << 20));
+        return buffer;
+}
+
+
+namespace
+{
+// bumped by Invalidate, e.g. when an IPR edit changes a gpuCache
+unsigned int budgetGeneration = 0;
+}
+
+bool GpuCacheFirstInSession( const char* marker )
+{
+        AtNode* options = AiUniverseGetOptions();
+        if (options == NULL)
+                return true;
+        if (AiNodeLookUpUserParameter( options, marker ) != NULL)
+                return false;
+
+        AiNodeDeclare( options, marker, "constant BOOL" );
+        AiNodeSetBool( options, marker, true );
+        return true;
+}
+
+const GpuCacheBudget& GpuCacheBudget::Get( unsigned int motionKeys )
+{
+        // one forecast per render: a new session, a new frame or an
+        // invalidation starts over
+        static GpuCacheBudget budget;
+        static double frame = 0.0;
+        static unsigned int generation = 0;
+
+        double currentFrame = MAnimControl::currentTime().as(MTime::uiUnit());
+        if (GpuCacheFirstInSession( "gpucache_budget" ) || frame != currentFrame ||
+            generation != budgetGeneration)
+        {
+                frame = currentFrame;
+                generation = budgetGeneration;
+
+                budget = GpuCacheBudget();
+                budget.ReadEnvironment();
+                // without a scene budget there is nothing to share out, so the
+                // archives of the whole scene are not walked
+                if (budget.m_budgetBytes > 0)
+                {
+                        budget.Scan( motionKeys );
+                        budget.Enforce();
+                }
+        }
+        return budget;
+}
+
+unsigned int GpuCacheBudget::NodeMotionKeys( const MDagPath& dagPath, unsigned int motionKeys )
+{
+        MPlug plug = MFnDagNode( dagPath ).findPlug("motionBlur");
+        return !plug.isNull() && plug.asBool() ? motionKeys : 1;
+}
+
+void GpuCacheBudget::Invalidate()
+{
+        ++budgetGeneration;
+}
+
+const GpuCacheBudget::Node* GpuCacheBudget::Find( const MDagPath& dagPath ) const
+{
+        std::map<std::string, Node>::const_iterator it = m_nodes.find( dagPath.fullPathName().asChar() );
+        return it == m_nodes.end() ? NULL : &it->second;
+}
+
+void GpuCacheBudget::ReadEnvironment()
+{
+        const char* budget = getenv("GPUCACHE_MEMORY_BUDGET");
+        if (budget)
+                m_budgetBytes = strtoull(budget, NULL, 10) << 20;
+
+        const char* policy = getenv("GPUCACHE_BUDGET_POLICY");
+        if (policy && strcmp(policy, "proxy") == 0)
+                m_policy = kProxy;
+        else if (policy && strcmp(policy, "disable") == 0)
+                m_policy = kDisable;
+}
+
+void GpuCacheBudget::Scan( unsigned int motionKeys )
+{
+        for (MItDag it(MItDag::kDepthFirst, MFn::kPluginShape); !it.isDone(); it.next())
+        {
+                MDagPath dagPath;
+                it.getPath(dagPath);
+                MFnDagNode fnDagNode( dagPath );
+                if (fnDagNode.typeName() != "gpuCache" ||
+                    fnDagNode.isIntermediateObject() ||
+                    !dagPath.isVisible())
+                        continue;
+
+                const unsigned int keys = NodeMotionKeys( dagPath, motionKeys );
+
+                Node node;
+                node.estimate = GpuCacheEstimateMemory( GpuCacheMemoryParams::FromNode(dagPath, keys) );
+
+                std::string proxyFile = plugString( fnDagNode, "proxyCacheFileName" );
+                if (!proxyFile.empty())
+                {
+                        GpuCacheMemoryParams proxyParams;
+                        proxyParams.filename = proxyFile;
+                        proxyParams.objectPath = plugString( fnDagNode, "proxyGeomPath" );
+                        proxyParams.motionKeys = keys;
+                        node.proxyEstimate = GpuCacheEstimateMemory( proxyParams );
+                        node.hasProxy = node.proxyEstimate.valid;
+                }
+
+                m_totalBytes += node.estimate.bytes;
+                m_nodes[dagPath.fullPathName().asChar()] = node;
+        }
+
+        GPUCACHE_LOG_INFO("scene memory forecast: %s for %d gpuCache nodes",
+                          GpuCacheFormatBytes(m_totalBytes).c_str(), (int)m_nodes.size());
+}
+
+void GpuCacheBudget::Enforce()
+{
+        if (m_budgetBytes == 0 || m_totalBytes <= m_budgetBytes)
+                return;
+
+        std::vector<std::pair<unsigned long long, std::string> > heaviest;
+        for (std::map<std::string, Node>::const_iterator it = m_nodes.begin(); it != m_nodes.end(); ++it)
+                heaviest.push_back( std::make_pair(it->second.estimate.bytes, it->first) );
+        std::sort( heaviest.rbegin(), heaviest.rend() );
+
+        if (m_policy == kWarn)
+        {
+                GPUCACHE_LOG_WARNING("scene memory forecast %s exceeds the budget of %s, heaviest is %s (%s)",
+                                     GpuCacheFormatBytes(m_totalBytes).c_str(), GpuCacheFormatBytes(m_budgetBytes).c_str(),
+                                     heaviest[0].second.c_str(), GpuCacheFormatBytes(heaviest[0].first).c_str());
+                return;
+        }
+
+        // one summary line for the scene, the nodes themselves at debug level
+        unsigned int proxied = 0, disabled = 0;
+        for (size_t i = 0; i < heaviest.size() && m_totalBytes > m_budgetBytes; ++i)
+        {
+                Node& node = m_nodes[heaviest[i].second];
+                m_totalBytes -= node.estimate.bytes;
+
+                if (m_policy == kProxy && node.hasProxy)
+                {
+                        node.action = kUseProxy;
+                        m_totalBytes += node.proxyEstimate.bytes;
+                        ++proxied;
+                }
+                else
+                {
+                        node.action = kDisabled;
+                        ++disabled;
+                }
+
+                GPUCACHE_REPORT_DEBUG("memory budget: %s %s (%s)",
+                                      node.action == kUseProxy ? "using the proxy of" : "disabling",
+                                      heaviest[i].second.c_str(), GpuCacheFormatBytes(heaviest[i].first).c_str());
+        }
+
+        GPUCACHE_LOG_WARNING("memory budget of %s: %u gpuCache nodes switched to their proxy, %u disabled, "
+                             "heaviest is %s (%s)",
+                             GpuCacheFormatBytes(m_budgetBytes).c_str(), proxied, disabled,
+                             heaviest[0].second.c_str(), GpuCacheFormatBytes(heaviest[0].first).c_str());
+
+        if (m_totalBytes > m_budgetBytes)
+                GPUCACHE_LOG_WARNING("scene memory forecast %s still exceeds the budget of %s",
+                                     GpuCacheFormatBytes(m_totalBytes).c_str(), GpuCacheFormatBytes(m_budgetBytes).c_str());
+}
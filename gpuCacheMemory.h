@@ -0,0 +1,132 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheMemory.h
+ *
+ *  Export-time forecast of the memory a gpuCache expands to, and the scene
+ *  wide budget applied to those forecasts before the render starts.
+ */
+
+#pragma once
+
+#include <maya/MDagPath.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// What a node would expand, as far as memory is concerned.
+struct GpuCacheMemoryParams
+{
+        GpuCacheMemoryParams() : subDIterations(0), motionKeys(1) {}
+
+        /// Reads the parameters from the gpuCache node's plugs. Adaptive
+        /// subdivision counts as its max iterations.
+        static GpuCacheMemoryParams FromNode( const MDagPath& dagPath, unsigned int motionKeys );
+
+        /// The archive and the layers opened on top of it, in order.
+        std::vector<std::string> Archives() const;
+
+        std::string filename;
+        std::vector<std::string> layers;
+        std::string objectPath;
+        std::string pattern;
+        std::string excludePattern;
+        int subDIterations;
+        unsigned int motionKeys;
+};
+
+struct GpuCacheMemoryEstimate
+{
+        GpuCacheMemoryEstimate() : valid(false), objects(0), polygons(0), bytes(0) {}
+
+        bool valid;                     // false if the archive could not be read
+        unsigned int objects;
+        unsigned long long polygons;    // after subdivision
+        unsigned long long bytes;
+};
+
+GpuCacheMemoryEstimate GpuCacheEstimateMemory( const GpuCacheMemoryParams& params );
+
+struct GpuCacheObjectStats;
+
+/// Forecast for one object of an archive index.
+unsigned long long GpuCacheObjectMemory( const GpuCacheObjectStats& stats,
+                                         int subDIterations,
+                                         unsigned int motionKeys );
+
+/// Scene wide forecast for every visible gpuCache, computed once per render
+/// session and frame when a scene budget is set, and again after Invalidate.
+/// 'motionKeys' is the session's number of object motion keys, nodes with
+/// motionBlur off are forecast with one. The
+/// budget and policy come from the environment:
+///   GPUCACHE_MEMORY_BUDGET  scene budget in MB, unset or 0 disables it
+///   GPUCACHE_BUDGET_POLICY  warn (default), proxy or disable
+/// With proxy or disable the heaviest nodes are switched, one by one, to their
+/// proxy (proxyCacheFileName / proxyGeomPath) or disabled until the forecast
+/// fits. Nodes without a proxy are disabled under the proxy policy.
+class GpuCacheBudget
+{
+public :
+        enum Policy
+        {
+                kWarn,
+                kProxy,
+                kDisable
+        };
+
+        enum Action
+        {
+                kKeep,
+                kUseProxy,
+                kDisabled
+        };
+
+        struct Node
+        {
+                Node() : hasProxy(false), action(kKeep) {}
+
+                GpuCacheMemoryEstimate estimate;
+                GpuCacheMemoryEstimate proxyEstimate;
+                bool hasProxy;
+                Action action;
+        };
+
+        static const GpuCacheBudget& Get( unsigned int motionKeys );
+
+        /// Motion keys of the node at 'dagPath' when the session exports
+        /// 'motionKeys' of them: one unless its motionBlur is on.
+        static unsigned int NodeMotionKeys( const MDagPath& dagPath, unsigned int motionKeys );
+
+        /// Drops the current forecast, the next Get computes it again.
+        static void Invalidate();
+
+        /// Entry for the node with full path 'dagPath', NULL if it was not part
+        /// of the scene forecast. Only a scene budget triggers the forecast.
+        const Node* Find( const MDagPath& dagPath ) const;
+
+        Policy GetPolicy() const { return m_policy; }
+
+        unsigned long long TotalBytes() const { return m_totalBytes; }
+        unsigned long long BudgetBytes() const { return m_budgetBytes; }
+
+private :
+        GpuCacheBudget() : m_policy(kWarn), m_totalBytes(0), m_budgetBytes(0) {}
+
+        void ReadEnvironment();
+        void Scan( unsigned int motionKeys );
+        void Enforce();
+
+        Policy m_policy;
+        std::map<std::string, Node> m_nodes;
+        unsigned long long m_totalBytes;
+        unsigned long long m_budgetBytes;
+};
+
+/// True the first time it is called with 'marker' in the current render
+/// session. The marker is left as user data on the Arnold options node, so
+/// a new session is told apart even when its options node sits at the
+/// address of the previous one.
+bool GpuCacheFirstInSession( const char* marker );
+
+/// "12.3 MB" style formatting for the reports.
+std::string GpuCacheFormatBytes( unsigned long long bytes );
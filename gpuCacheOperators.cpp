@@ -0,0 +1,378 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheOperators.cpp
+ *
+ *  Override and user attribute dictionaries compiled to Arnold operators.
+ */
+
+#include "gpuCacheOperators.h"
+#include "gpuCacheJson.h"
+#include "gpuCacheLog.h"
+
+#include <sys/stat.h>
+
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+
+bool readFile( const std::string& filename, std::string& contents )
+{
+        std::ifstream file( filename.c_str() );
+        if (!file)
+                return false;
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        contents = stream.str();
+        return true;
+}
+
+/// Literal for the right hand side of a set_parameter assignment.
+bool formatValue( const GpuCacheJsonValue& value, std::string& literal )
+{
+        switch (value.GetType())
+        {
+          case GpuCacheJsonValue::kBool:
+            literal = value.AsBool() ? "true" : "false";
+            return true;
+          case GpuCacheJsonValue::kNumber:
+            literal = value.NumberText();
+            return true;
+          case GpuCacheJsonValue::kString:
+          {
+            literal = "'";
+            for (size_t i = 0; i < value.AsString().size(); ++i)
+            {
+                    const char c = value.AsString()[i];
+                    if (c == '\'' || c == '\\')
+                            literal += '\\';
+                    literal += c;
+            }
+            literal += "'";
+            return true;
+          }
+          case GpuCacheJsonValue::kArray:
+          {
+            // colours and vectors are written as space separated components
+            literal.clear();
+            const std::vector<GpuCacheJsonValue>& elements = value.Elements();
+            for (size_t i = 0; i < elements.size(); ++i)
+            {
+                    if (elements[i].GetType() != GpuCacheJsonValue::kNumber)
+                            return false;
+                    if (i > 0)
+                            literal += " ";
+                    literal += elements[i].NumberText();
+            }
+            return !elements.empty();
+          }
+          default :
+            return false;
+        }
+}
+
+/// Arnold user data type for a user attribute value. Numbers are typed the
+/// way JSON readers do: integer text is INT, a '.' or an exponent makes it
+/// FLOAT. Integers beyond 32 bits have no exact user data type.
+const char* declareType( const GpuCacheJsonValue& value )
+{
+        switch (value.GetType())
+        {
+          case GpuCacheJsonValue::kBool:
+            return "BOOL";
+          case GpuCacheJsonValue::kNumber:
+          {
+            const std::string& text = value.NumberText();
+            if (text.find_first_of(".eE") != std::string::npos)
+                    return "FLOAT";
+            const long long number = strtoll(text.c_str(), NULL, 10);
+            return number >= INT_MIN && number <= INT_MAX ? "INT" : NULL;
+          }
+          case GpuCacheJsonValue::kString:
+            return "STRING";
+          case GpuCacheJsonValue::kArray:
+            if (value.Elements().size() == 2)
+                    return "VECTOR2";
+            if (value.Elements().size() == 3)
+                    return "RGB";
+            if (value.Elements().size() == 4)
+                    return "RGBA";
+            return NULL;
+          default :
+            return NULL;
+        }
+}
+
+/// Object patterns are passed to set_parameter as selections. Only plain
+/// paths and '*' mean the same thing there as in the procedural, anything
+/// else (spaces, brackets, regular expression syntax) is left to it.
+bool plainPattern( const std::string& pattern )
+{
+        if (pattern.empty())
+                return false;
+        for (size_t i = 0; i < pattern.size(); ++i)
+        {
+                const char c = pattern[i];
+                if (!isalnum((unsigned char)c) && strchr("_/:.*-", c) == NULL)
+                        return false;
+        }
+        return true;
+}
+
+/// One set_parameter operator. The selection does not carry the name prefix
+/// yet, so the same parsed file serves every prefix.
+struct Operator
+{
+        std::string selection;
+        std::vector<std::string> assignments;
+};
+
+/// A dictionary turned into operators, one per object pattern. 'valid' is
+/// false if any entry cannot be expressed exactly, the procedural then has
+/// to apply the whole dictionary itself.
+struct Dictionary
+{
+        Dictionary() : valid(false) {}
+
+        bool valid;
+        std::vector<Operator> operators;
+};
+
+void compileDictionary( const std::string& text, bool declare, const char* origin, Dictionary& result )
+{
+        result = Dictionary();
+        if (text.empty())
+        {
+                result.valid = true;
+                return;
+        }
+
+        GpuCacheJsonValue dictionary;
+        std::string error;
+        if (!GpuCacheJsonValue::Parse(text, dictionary, error) || !dictionary.IsObject())
+        {
+                GPUCACHE_LOG_WARNING("%s is not a valid dictionary: %s",
+                                     origin, error.empty() ? "expected an object" : error.c_str());
+                return;
+        }
+
+        const GpuCacheJsonValue::Members& patterns = dictionary.GetMembers();
+        for (size_t i = 0; i < patterns.size(); ++i)
+        {
+                if (!patterns[i].second.IsObject() || !plainPattern(patterns[i].first))
+                {
+                        GPUCACHE_LOG_INFO("%s: %s cannot be compiled, left to the procedural",
+                                          origin, patterns[i].first.c_str());
+                        result.operators.clear();
+                        return;
+                }
+
+                Operator op;
+                op.selection = patterns[i].first;
+                const GpuCacheJsonValue::Members& parameters = patterns[i].second.GetMembers();
+                for (size_t p = 0; p < parameters.size(); ++p)
+                {
+                        const std::string& name = parameters[p].first;
+                        std::string literal;
+                        const char* type = declareType(parameters[p].second);
+                        if (!formatValue(parameters[p].second, literal) || (declare && type == NULL))
+                        {
+                                GPUCACHE_LOG_INFO("%s: %s on %s cannot be compiled, left to the procedural",
+                                                  origin, name.c_str(), patterns[i].first.c_str());
+                                result.operators.clear();
+                                return;
+                        }
+                        if (declare)
+                                op.assignments.push_back("declare " + name + " constant " + type);
+                        op.assignments.push_back(name + "=" + literal);
+                }
+
+                if (!op.assignments.empty())
+                        result.operators.push_back(op);
+        }
+        result.valid = true;
+}
+
+/// Path, modification time and size of 'filename', which change whenever
+/// the file is rewritten. False if it cannot be stat'ed.
+bool fileStamp( const std::string& filename, std::string& stamp )
+{
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0)
+                return false;
+
+        std::ostringstream stream;
+        stream << filename << '\0' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << '\0' << st.st_size;
+        stamp = stream.str();
+        return true;
+}
+
+/// The dictionary in 'filename', read and compiled once for as long as the
+/// file stays the same however many nodes share it. Fills 'stamp' with the
+/// file's identity. NULL if the file cannot be read.
+std::shared_ptr<const Dictionary> fileDictionary( const std::string& filename, bool declare, std::string& stamp )
+{
+        struct Cached
+        {
+                std::string stamp;
+                std::shared_ptr<const Dictionary> dictionary;
+        };
+        // one entry per file and role, replaced when the file changes
+        static std::map<std::string, Cached> cache;
+
+        if (!fileStamp(filename, stamp))
+                return std::shared_ptr<const Dictionary>();
+
+        Cached& cached = cache[filename + (declare ? "\0user" : "\0override")];
+        if (cached.dictionary && cached.stamp == stamp)
+                return cached.dictionary;
+
+        std::string contents;
+        if (!readFile(filename, contents))
+                return std::shared_ptr<const Dictionary>();
+
+        std::shared_ptr<Dictionary> dictionary( new Dictionary() );
+        compileDictionary( contents, declare, filename.c_str(), *dictionary );
+        cached.stamp = stamp;
+        cached.dictionary = dictionary;
+        return dictionary;
+}
+
+/// Creates the chain of the dictionaries' operators, in order, and returns
+/// its last operator or NULL if there are none. Only called once every
+/// dictionary compiled, so a failure leaves nothing in the universe.
+AtNode* buildChain( const std::string& baseName, const std::string& namePrefix,
+                    const std::vector<const Dictionary*>& dictionaries )
+{
+        AtNode* last = NULL;
+        size_t index = 0;
+        for (size_t d = 0; d < dictionaries.size(); ++d)
+        {
+                const std::vector<Operator>& operators = dictionaries[d]->operators;
+                for (size_t i = 0; i < operators.size(); ++i, ++index)
+                {
+                        std::ostringstream name;
+                        name << baseName << "_" << index;
+
+                        AtNode* op = AiNode("set_parameter");
+                        AiNodeSetStr( op, "name", name.str().c_str() );
+                        AiNodeSetStr( op, "selection", (namePrefix + operators[i].selection).c_str() );
+
+                        const std::vector<std::string>& assignments = operators[i].assignments;
+                        AtArray* assignmentArray = AiArrayAllocate( (unsigned int)assignments.size(), 1, AI_TYPE_STRING );
+                        for (size_t a = 0; a < assignments.size(); ++a)
+                                AiArraySetStr( assignmentArray, (unsigned int)a, assignments[a].c_str() );
+                        AiNodeSetArray( op, "assignment", assignmentArray );
+
+                        // later dictionaries and patterns win, as they do in the procedural
+                        if (last)
+                        {
+                                AtArray* inputs = AiArrayAllocate( 1, 1, AI_TYPE_NODE );
+                                AiArraySetPtr( inputs, 0, last );
+                                AiNodeSetArray( op, "inputs", inputs );
+                        }
+                        last = op;
+                }
+        }
+        return last;
+}
+
+} // namespace
+
+
+bool GpuCacheOperatorGraph::Supported( const AtNode* procedural )
+{
+        return AiNodeEntryLookUpParameter( AiNodeGetNodeEntry(procedural), "operator" ) != NULL;
+}
+
+AtNode* GpuCacheOperatorGraph::Get( const GpuCacheOperatorSources& sources )
+{
+        if (sources.Empty())
+                return NULL;
+
+        // files are stat'ed per node but only read when they change
+        std::string overrideStamp, userAttributesStamp;
+        std::shared_ptr<const Dictionary> overrideFile, userAttributesFile;
+        if (!sources.overrideFile.empty())
+        {
+                overrideFile = fileDictionary( sources.overrideFile, false, overrideStamp );
+                if (!overrideFile)
+                {
+                        GPUCACHE_LOG_WARNING("could not read %s", sources.overrideFile.c_str());
+                        return NULL;
+                }
+        }
+        if (!sources.userAttributesFile.empty())
+        {
+                userAttributesFile = fileDictionary( sources.userAttributesFile, true, userAttributesStamp );
+                if (!userAttributesFile)
+                {
+                        GPUCACHE_LOG_WARNING("could not read %s", sources.userAttributesFile.c_str());
+                        return NULL;
+                }
+        }
+
+        // Compiled graphs live in the universe, forget them when it is replaced
+        static std::map<std::string, std::string> graphs;
+        static const AtNode* options = NULL;
+        static int compiled = 0;
+        if (options != AiUniverseGetOptions())
+        {
+                options = AiUniverseGetOptions();
+                graphs.clear();
+                compiled = 0;
+        }
+
+        std::string key = sources.namePrefix + '\0' + overrideStamp + '\0' + sources.overrides + '\0' +
+                          userAttributesStamp + '\0' + sources.userAttributes;
+
+        std::map<std::string, std::string>::const_iterator it = graphs.find(key);
+        if (it != graphs.end())
+        {
+                // dictionaries that could not be compiled are not tried again
+                if (it->second.empty())
+                        return NULL;
+                AtNode* last = AiNodeLookUpByName( it->second.c_str() );
+                if (last)
+                        return last;
+        }
+
+        // file first, then the inline dictionary on top of it
+        Dictionary overrides, userAttributes;
+        compileDictionary( sources.overrides, false, "overrides", overrides );
+        compileDictionary( sources.userAttributes, true, "userAttributes", userAttributes );
+
+        Dictionary empty;
+        empty.valid = true;
+        std::vector<const Dictionary*> dictionaries;
+        dictionaries.push_back( overrideFile ? overrideFile.get() : &empty );
+        dictionaries.push_back( &overrides );
+        dictionaries.push_back( userAttributesFile ? userAttributesFile.get() : &empty );
+        dictionaries.push_back( &userAttributes );
+        for (size_t i = 0; i < dictionaries.size(); ++i)
+        {
+                if (!dictionaries[i]->valid)
+                {
+                        graphs[key] = "";
+                        return NULL;
+                }
+        }
+
+        std::ostringstream baseName;
+        baseName << "gpuCacheOperators" << compiled++;
+
+        AtNode* last = buildChain( baseName.str(), sources.namePrefix, dictionaries );
+        if (last == NULL)
+                return NULL;
+
+        graphs[key] = AiNodeGetName( last );
+        return last;
+}
@@ -0,0 +1,45 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheOperators.h
+ *
+ *  Compiles the override and user attribute dictionaries of a gpuCache into
+ *  a chain of Arnold set_parameter operators, shared by every procedural
+ *  that uses the same dictionaries.
+ */
+
+#pragma once
+
+#include <ai.h>
+
+#include <string>
+
+struct GpuCacheOperatorSources
+{
+        std::string overrides;
+        std::string overrideFile;
+        std::string userAttributes;
+        std::string userAttributesFile;
+        std::string namePrefix;
+
+        bool Empty() const
+        {
+                return overrides.empty() && overrideFile.empty() &&
+                       userAttributes.empty() && userAttributesFile.empty();
+        }
+};
+
+class GpuCacheOperatorGraph
+{
+public :
+        /// True if Arnold can attach operators to 'procedural' directly.
+        static bool Supported( const AtNode* procedural );
+
+        /// Last operator of the chain compiled from 'sources'. Each distinct
+        /// set of dictionaries is compiled once per Arnold universe; files
+        /// are told apart by path, modification time and size, and are only
+        /// read and parsed again when those change. Returns NULL, creating no node, when there is
+        /// nothing to apply, the dictionaries cannot be read, or any entry
+        /// cannot be expressed exactly as an operator; the procedural must
+        /// then apply the dictionaries itself.
+        static AtNode* Get( const GpuCacheOperatorSources& sources );
+};
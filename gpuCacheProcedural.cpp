@@ -0,0 +1,32 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheProcedural.cpp
+ *
+ *  Feature checks on the alembic_loader procedural.
+ */
+
+#include "gpuCacheProcedural.h"
+
+#include <ai.h>
+
+#include <cstdlib>
+#include <string>
+
+bool GpuCacheProceduralSupports( const char* feature )
+{
+        const AtNodeEntry* entry = AiNodeEntryLookUp( "alembic_loader" );
+        if (entry)
+        {
+                const std::string name = std::string("gpucache_") + feature;
+                bool supported = false;
+                if (AiMetaDataGetBool( entry, AtString(), AtString(name.c_str()), &supported ))
+                        return supported;
+        }
+
+        const char* features = getenv("GPUCACHE_PROCEDURAL_FEATURES");
+        if (features == NULL)
+                return false;
+
+        const std::string list = std::string(",") + features + ",";
+        return list.find(std::string(",") + feature + ",") != std::string::npos;
+}
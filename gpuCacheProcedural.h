@@ -0,0 +1,18 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheProcedural.h
+ *
+ *  What the installed alembic_loader procedural understands beyond the
+ *  arguments every version reads.
+ */
+
+#pragma once
+
+/// Whether the alembic_loader procedural loaded in Arnold handles 'feature'
+/// ("layers" for -layers, "batch" for -batch, "instancegroups" for the
+/// instanceGroups user parameter). A procedural declares it with
+/// the boolean node metadata "gpucache_<feature>" set to true. Procedurals
+/// without that metadata can be vouched for with GPUCACHE_PROCEDURAL_FEATURES,
+/// a comma separated list of features. Anything else counts as unsupported,
+/// and the translator exports the arguments older procedurals read.
+bool GpuCacheProceduralSupports( const char* feature );
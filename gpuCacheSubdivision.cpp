@@ -0,0 +1,188 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheSubdivision.cpp
+ *
+ *  Screen-space driven choice of subdivision iterations per gpuCache.
+ */
+
+#include "gpuCacheSubdivision.h"
+
+#include <maya/MDGContext.h>
+#include <maya/MFnCamera.h>
+#include <maya/MFnDagNode.h>
+#include <maya/MFnDependencyNode.h>
+#include <maya/MFnMatrixData.h>
+#include <maya/MItDag.h>
+#include <maya/MPlug.h>
+#include <maya/MPoint.h>
+#include <maya/MSelectionList.h>
+#include <maya/MTime.h>
+#include <maya/MVector.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+
+MDagPath firstRenderableCamera()
+{
+        for (MItDag it(MItDag::kDepthFirst, MFn::kCamera); !it.isDone(); it.next())
+        {
+                MDagPath path;
+                it.getPath(path);
+                MPlug plug = MFnDagNode(path).findPlug("renderable");
+                if (!plug.isNull() && plug.asBool())
+                        return path;
+        }
+        return MDagPath();
+}
+
+int resolutionWidth()
+{
+        MSelectionList list;
+        MObject node;
+        if (list.add("defaultResolution") && list.getDependNode(0, node))
+        {
+                MPlug plug = MFnDependencyNode(node).findPlug("width");
+                if (!plug.isNull())
+                        return plug.asInt();
+        }
+        return 1920;
+}
+
+} // namespace
+
+MMatrix GpuCacheWorldMatrixAt( const MDagPath& path, double frame )
+{
+        MFnDagNode fnDagNode( path );
+        MPlug plug = fnDagNode.findPlug("worldMatrix").elementByLogicalIndex(path.instanceNumber());
+        MDGContext context( MTime(frame, MTime::uiUnit()) );
+        MFnMatrixData matrixData( plug.asMObject(context) );
+        return matrixData.matrix();
+}
+
+float GpuCacheProjectedSize( const MDagPath& object,
+                             const MBoundingBox& bounds,
+                             const MDagPath& camera,
+                             const std::vector<double>& frames )
+{
+        MDagPath cameraPath = camera.isValid() ? camera : firstRenderableCamera();
+        if (!cameraPath.isValid())
+                return -1.0f;
+
+        MFnCamera fnCamera( cameraPath );
+        const int width = resolutionWidth();
+        const double aspect = fnCamera.aspectRatio();
+        const double tanHalfFov = tan(fnCamera.horizontalFieldOfView() * 0.5);
+
+        const MPoint corners[8] = {
+                MPoint(bounds.min().x, bounds.min().y, bounds.min().z),
+                MPoint(bounds.max().x, bounds.min().y, bounds.min().z),
+                MPoint(bounds.min().x, bounds.max().y, bounds.min().z),
+                MPoint(bounds.max().x, bounds.max().y, bounds.min().z),
+                MPoint(bounds.min().x, bounds.min().y, bounds.max().z),
+                MPoint(bounds.max().x, bounds.min().y, bounds.max().z),
+                MPoint(bounds.min().x, bounds.max().y, bounds.max().z),
+                MPoint(bounds.max().x, bounds.max().y, bounds.max().z) };
+
+        float size = 0.0f;
+        for (size_t f = 0; f < frames.size(); ++f)
+        {
+                MMatrix toCamera = GpuCacheWorldMatrixAt(object, frames[f]) * GpuCacheWorldMatrixAt(cameraPath, frames[f]).inverse();
+
+                MPoint inCamera[8];
+                for (int c = 0; c < 8; ++c)
+                        inCamera[c] = corners[c] * toCamera;
+
+                // Maya cameras look down -Z. The box is clipped by the near
+                // plane: corners in front are kept, and each edge crossing the
+                // plane adds the point where it does.
+                std::vector<MPoint> visible;
+                if (fnCamera.isOrtho())
+                {
+                        visible.assign(inCamera, inCamera + 8);
+                }
+                else
+                {
+                        const double nearPlane = fnCamera.nearClippingPlane();
+                        for (int c = 0; c < 8; ++c)
+                        {
+                                const bool front = -inCamera[c].z > nearPlane;
+                                if (front)
+                                        visible.push_back(inCamera[c]);
+
+                                // the three edges leaving corner c, each visited once
+                                for (int bit = 1; bit < 8; bit <<= 1)
+                                {
+                                        const int other = c ^ bit;
+                                        if (other < c || front == (-inCamera[other].z > nearPlane))
+                                                continue;
+                                        const double t = (-nearPlane - inCamera[c].z) / (inCamera[other].z - inCamera[c].z);
+                                        visible.push_back(inCamera[c] + (inCamera[other] - inCamera[c]) * t);
+                                }
+                        }
+                }
+
+                // entirely behind the camera at this frame
+                if (visible.empty())
+                        continue;
+
+                double minX = DBL_MAX, minY = DBL_MAX;
+                double maxX = -DBL_MAX, maxY = -DBL_MAX;
+                for (size_t c = 0; c < visible.size(); ++c)
+                {
+                        const MPoint& p = visible[c];
+                        double x, y;
+                        if (fnCamera.isOrtho())
+                        {
+                                x = p.x / (fnCamera.orthoWidth() * 0.5);
+                                y = p.y / (fnCamera.orthoWidth() * 0.5);
+                        }
+                        else
+                        {
+                                x = p.x / (-p.z * tanHalfFov);
+                                y = p.y / (-p.z * tanHalfFov);
+                        }
+                        minX = std::min(minX, x);
+                        maxX = std::max(maxX, x);
+                        minY = std::min(minY, y);
+                        maxY = std::max(maxY, y);
+                }
+
+                // clip to the frame, x spans [-1, 1] and y [-1/aspect, 1/aspect]
+                minX = std::max(minX, -1.0);
+                maxX = std::min(maxX, 1.0);
+                minY = std::max(minY, -1.0 / aspect);
+                maxY = std::min(maxY, 1.0 / aspect);
+                if (maxX <= minX || maxY <= minY)
+                        continue;
+
+                double extent = std::max(maxX - minX, maxY - minY) * 0.5;
+                size = std::max(size, float(extent * width));
+        }
+        return std::min(size, float(width));
+}
+
+int GpuCacheAdaptiveIterations( float screenSize,
+                                int minIterations,
+                                int maxIterations )
+{
+        if (maxIterations < minIterations)
+                maxIterations = minIterations;
+        if (screenSize <= 0.0f)
+                return minIterations;
+
+        const float coverage = std::min(1.0f, screenSize / float(resolutionWidth()));
+        int iterations = maxIterations + int(floorf(log2f(coverage)));
+        return std::max(minIterations, std::min(maxIterations, iterations));
+}
+
+unsigned long long GpuCacheSubdividedPolygons( unsigned long long basePolygons,
+                                               int iterations )
+{
+        for (int i = 0; i < iterations; ++i)
+                basePolygons *= 4;
+        return basePolygons;
+}
@@ -0,0 +1,39 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheSubdivision.h
+ *
+ *  Screen-space driven choice of subdivision iterations per gpuCache.
+ */
+
+#pragma once
+
+#include <maya/MBoundingBox.h>
+#include <maya/MDagPath.h>
+#include <maya/MMatrix.h>
+
+#include <vector>
+
+/// World matrix of 'path' evaluated at 'frame', whatever the current time.
+MMatrix GpuCacheWorldMatrixAt( const MDagPath& path, double frame );
+
+/// Largest on-screen size, in pixels, of 'bounds' (object space of 'object')
+/// seen from 'camera' over all 'frames'. The part of the box behind the near
+/// plane is clipped away, so a box entirely behind the camera measures 0. If
+/// 'camera' is invalid the first renderable camera of the scene is used; with
+/// no camera at all this returns a negative value.
+float GpuCacheProjectedSize( const MDagPath& object,
+                             const MBoundingBox& bounds,
+                             const MDagPath& camera,
+                             const std::vector<double>& frames );
+
+/// Iterations for something 'screenSize' pixels wide: 'maxIterations' when it
+/// fills the image, one less for each halving of its size, never below
+/// 'minIterations'.
+int GpuCacheAdaptiveIterations( float screenSize,
+                                int minIterations,
+                                int maxIterations );
+
+/// Catmull-Clark turns every face into quads and each quad into four quads
+/// per iteration, so this is an upper bound for meshes with n-gons.
+unsigned long long GpuCacheSubdividedPolygons( unsigned long long basePolygons,
+                                               int iterations );
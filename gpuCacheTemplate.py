@@ -78,6 +78,7 @@ class GpuCacheTemplate(templates.ShapeTranslatorTemplate):
         self.addControl('loadAtInit', label='Load at Initalisation')
         self.addControl('frame', label='Frame')
         self.addControl('timeOffset', label='Frame Offset')
+        self.addControl('cacheLayers', label='Cache Layers')
         self.addControl('objectPattern', label='Object Pattern')
         self.addControl('excludePattern', label='Exclude Pattern')
         self.addControl('namePrefix', label='Name Prefix')
@@ -113,6 +114,8 @@ class GpuCacheTemplate(templates.ShapeTranslatorTemplate):
         self.addControl('skipUserAttributes', label='Skip User Attributes')
         self.endLayout()
 
+        self.addControl('compileOverrides', label='Compile Overrides to Operators')
+
         self.addSeparator()
 
         self.beginLayout('Points', collapse=False)
@@ -124,11 +127,27 @@ class GpuCacheTemplate(templates.ShapeTranslatorTemplate):
         self.addControl('modeCurve', label='Curve Mode')
         self.endLayout()
 
+        self.beginLayout('Adaptive Subdivision', collapse=True)
+        self.addControl('subDAdaptive', label='Enable')
+        self.addControl('subDMinIterations', label='Min Iterations')
+        self.addControl('subDMaxIterations', label='Max Iterations')
+        self.endLayout()
+
+        self.beginLayout('Memory Budget', collapse=True)
+        self.addControl('memoryBudget', label='Node Budget (MB)')
+        self.addControl('proxyCacheFileName', label='Proxy Cache File')
+        self.addControl('proxyGeomPath', label='Proxy Geometry Path')
+        self.endLayout()
+
         self.beginLayout('Advanced', collapse=False)
         self.addControl('makeInstance', label='Make Instance')
+        self.addControl('autoInstance', label='Auto Instance')
+        self.addControl('autoInstanceThreshold', label='Auto Instance Min Saving (MB)')
+        self.addControl('batchByArchive', label='Batch by Archive')
         self.addControl('flipv', label='Flip V Coord')
         self.addControl('invertNormals', label='Invert Normals')
         self.addControl('scaleVelocity', label='Scale Velocity')
+        self.addControl('iprInMemory', label='IPR In-Memory Geometry')
         self.endLayout()
         self.addControl('aiUserOptions', label='User Options')
 
@@ -10,8 +10,20 @@
 #include <maya/MBoundingBox.h>
 #include <maya/MPlugArray.h>
 #include <maya/MTypes.h>
+#include <maya/MAnimControl.h>
+
+#include <algorithm>
 
 #include "gpuCacheTranslator.h"
+#include "gpuCacheSubdivision.h"
+#include "gpuCacheArchive.h"
+#include "gpuCacheMemory.h"
+#include "gpuCacheInstancing.h"
+#include "gpuCacheBatching.h"
+#include "gpuCacheProcedural.h"
+#include "gpuCacheOperators.h"
+#include "gpuCacheLog.h"
+#include "gpuCacheWatcher.h"
 
 /*
  * Return a new string with all occurrences of 'from' replaced with 'to'
@@ -49,14 +61,41 @@ int DJB2Hash(unsigned char *str)
 }
 
 
+GpuCacheTranslator::~GpuCacheTranslator()
+{
+    GpuCacheFileWatcher::Instance().Unwatch(this);
+}
+
 AtNode* GpuCacheTranslator::CreateArnoldNodes()
 {
-    AiMsgDebug("[GpuCacheTranslator] CreateArnoldNodes()");
+    GPUCACHE_LOG_DEBUG("CreateArnoldNodes()");
     m_isMasterDag =  IsMasterInstance();
     m_masterDag = GetMasterInstance();
-    if (m_isMasterDag)
+    UseBatch();
+    m_inMemory = m_isMasterDag && UseInMemoryGeometry();
+    if (m_inMemory)
     {
-      return AddArnoldNode( "alembic_loader" );
+      // one shape node per in-memory buffer, the first one is the root
+      AtNode* root = AddArnoldNode( GpuCacheBuffersNodeType(m_memoryBuffers[0]) );
+      for (size_t i = 1; i < m_memoryBuffers.size(); ++i)
+      {
+        MString tag = "mem";
+        tag += (unsigned int)i;
+        AddArnoldNode( GpuCacheBuffersNodeType(m_memoryBuffers[i]), tag.asChar() );
+      }
+      return root;
+    }
+    else if (m_isMasterDag)
+    {
+      m_memoryBuffers.clear();
+      AtNode* node = AddArnoldNode( "alembic_loader" );
+      // the first member of a batch MtoA exports leads it
+      if (m_batch && m_batch->procedural == NULL)
+      {
+        m_batch->procedural = node;
+        m_batchLeader = true;
+      }
+      return node;
     }
     else
     {
@@ -68,12 +107,15 @@ void GpuCacheTranslator::Delete()
 {
    // If the procedural has been expanded at export,
    // we need to delete all the created nodes here
-   AiMsgDebug("[GpuCacheTranslator] Delete()");
+   GPUCACHE_LOG_DEBUG("Delete()");
+   GpuCacheFileWatcher::Instance().Unwatch(this);
    CShapeTranslator::Delete();
 }
 
 void GpuCacheTranslator::RequestUpdate()
 {
+    // budget, proxy or archive may have changed, forecast the scene again
+    GpuCacheBudget::Invalidate();
     SetUpdateMode(AI_RECREATE_NODE);
     CShapeTranslator::RequestUpdate();
 }
@@ -86,13 +128,26 @@ void GpuCacheTranslator::Export( AtNode* instance )
         // we should never get here. Early out for safety
         return;
     }
-    AiMsgDebug("[GpuCacheTranslator] Export()");
+    GPUCACHE_LOG_DEBUG("Export()");
 
     const char* nodeType = AiNodeEntryGetName(AiNodeGetNodeEntry(instance));
     if (strcmp(nodeType, "ginstance") == 0)
     {
         ExportInstance(instance, m_masterDag, false);
     }
+    else if (m_inMemory)
+    {
+        ExportInMemory(instance);
+    }
+    else if (m_batch)
+    {
+        // the leader's procedural expands every member appended to it
+        if (m_batchLeader)
+            ExportProcedural(instance, false);
+        else
+            AiNodeSetDisabled(instance, true);
+        AppendToBatch();
+    }
     else
     {
 
@@ -109,7 +164,7 @@ AtNode* GpuCacheTranslator::ExportInstance(AtNode *instance, const MDagPath& mas
 
    if ( instanceNum > 0 )
      {
-       std::cout << "ExportInstance::instanceNum :: " << instanceNum << std::endl;
+       GPUCACHE_LOG_DEBUG("%s: exporting instance %d", m_dagPath.partialPathName().asChar(), instanceNum);
 
        AiNodeSetStr(instance, "name", m_dagPath.partialPathName().asChar());
 
@@ -130,36 +185,20 @@ AtNode* GpuCacheTranslator::ExportInstance(AtNode *instance, const MDagPath& mas
 
 void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
 {
-        AiMsgDebug("[GpuCacheTranslator] ExportProcedural()");
-        // do basic node export
-        ExportMatrix( node );
+        GPUCACHE_LOG_DEBUG("ExportProcedural()");
+        const bool batched = m_batch != NULL;
 
-        // AiNodeSetPtr( node, "shader", arnoldShader(node) );
-
-        AiNodeSetInt( node, "visibility", ComputeVisibility() );
-
-        MPlug plug = FindMayaPlug( "receiveShadows" );
-        if( !plug.isNull() )
-        {
-                AiNodeSetBool( node, "receive_shadows", plug.asBool() );
-        }
+        // do basic node export, batches carry a matrix per entry instead
+        if (batched)
+            AiNodeSetMatrix( node, "matrix", AiM4Identity() );
+        else
+            ExportMatrix( node );
 
-        plug = FindMayaPlug( "aiSelfShadows" );
-        if( !plug.isNull() )
-        {
-                AiNodeSetBool( node, "self_shadows", plug.asBool() );
-        }
+        // AiNodeSetPtr( node, "shader", arnoldShader(node) );
 
-        plug = FindMayaPlug( "aiOpaque" );
-        if( !plug.isNull() )
-        {
-                AiNodeSetBool( node, "opaque", plug.asBool() );
-        }
+        ExportRenderFlags( node );
 
-        MStatus status;
-        MFnDependencyNode dnode(m_dagPath.node(), &status);
-        if (status)
-            AiNodeSetInt(node, "id", DJB2Hash((unsigned char*)dnode.name().asChar()));
+        MPlug plug;
 
         // now set the procedural-specific parameters
 
@@ -168,8 +207,12 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
             MFnDagNode fnDagNode( m_dagPath );
             MBoundingBox bound = fnDagNode.boundingBox();
 
-            AiNodeSetVec( node, "min", bound.min().x-m_dispPadding, bound.min().y-m_dispPadding, bound.min().z-m_dispPadding );
-            AiNodeSetVec( node, "max", bound.max().x+m_dispPadding, bound.max().y, bound.max().z+m_dispPadding );
+            // batch bounds grow as members are appended
+            if (!batched)
+            {
+                AiNodeSetVec( node, "min", bound.min().x-m_dispPadding, bound.min().y-m_dispPadding, bound.min().z-m_dispPadding );
+                AiNodeSetVec( node, "max", bound.max().x+m_dispPadding, bound.max().y, bound.max().z+m_dispPadding );
+            }
 
             // const char *dsoPath = getenv( "ALEMBIC_ARNOLD_PROCEDURAL_PATH" );
             // AiNodeSetStr( node, "filename",  dsoPath ? dsoPath : "bb_AlembicArnoldProcedural.so" );
@@ -182,6 +225,29 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
             //object path
             MString objectPath = fnDagNode.findPlug("cacheGeomPath").asString();
 
+            //archives layered over abcFile, ';' separated
+            MString cacheLayers = "";
+            plug = FindMayaPlug( "cacheLayers" );
+            if (!plug.isNull() )
+            {
+                    // rejoined without the white space, the procedural
+                    // splits its arguments on it
+                    std::vector<std::string> layers =
+                            GpuCacheSplitLayers( plug.asString().expandEnvironmentVariablesAndTilde().asChar() );
+                    for (size_t i = 0; i < layers.size(); ++i)
+                    {
+                            if (i > 0)
+                                    cacheLayers += ";";
+                            cacheLayers += layers[i].c_str();
+                    }
+            }
+            if (cacheLayers != "" && !GpuCacheProceduralSupports( "layers" ))
+            {
+                    GPUCACHE_LOG_WARNING("%s: the alembic_loader procedural does not read archive layers, "
+                                            "cacheLayers is ignored", m_dagPath.partialPathName().asChar());
+                    cacheLayers = "";
+            }
+
             //object pattern
             MString objectPattern = "*";
 
@@ -241,6 +307,33 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
                     subDIterations = plug.asInt();
             }
 
+            plug = FindMayaPlug( "subDAdaptive" );
+            if (!plug.isNull() && plug.asBool())
+            {
+                    subDIterations = AdaptiveSubDIterations( bound );
+            }
+
+            const int budgetAction = ApplyMemoryBudget( subDIterations );
+            switch (budgetAction)
+            {
+              case GpuCacheBudget::kUseProxy:
+                abcFile = FindMayaPlug( "proxyCacheFileName" ).asString().expandEnvironmentVariablesAndTilde();
+                objectPath = FindMayaPlug( "proxyGeomPath" ).asString();
+                if (objectPath == "")
+                  objectPath = "|";
+                cacheLayers = "";
+                // the hero's patterns need not match anything in the proxy,
+                // which is forecast whole as well
+                objectPattern = "*";
+                excludePattern = "";
+                break;
+              case GpuCacheBudget::kDisabled:
+                AiNodeSetDisabled( node, true );
+                break;
+              default :
+                break;
+            }
+
             MString nameprefix = "";
             plug = FindMayaPlug( "namePrefix" );
             if (!plug.isNull() )
@@ -257,6 +350,14 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
                     makeInstance = plug.asBool();
             }
 
+            std::vector<std::string> instanceGroups;
+            // a disabled node is never expanded, it is not worth the scan
+            if (!makeInstance && !batched && budgetAction != GpuCacheBudget::kDisabled)
+            {
+                    makeInstance = DetectInstances( abcFile, cacheLayers, objectPath, objectPattern, excludePattern,
+                                                    subDIterations, instanceGroups );
+            }
+
             // bool loadAtInit = true; 
             // plug = FindMayaPlug( "loadAtInit" );
             // if (!plug.isNull() )
@@ -316,7 +417,10 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
             float time = frame+timeOffset;
 
             MString argsString;
-            if (objectPath != "|"){
+            if (batched){
+                    argsString += " -batch ";
+            }
+            else if (objectPath != "|"){
                     argsString += " -objectpath ";
                     // convert "|" to "/"
 
@@ -359,6 +463,10 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
             }
             argsString += " -filename ";
             argsString += abcFile;
+            if (cacheLayers != ""){
+                    argsString += " -layers ";
+                    argsString += cacheLayers;
+            }
             argsString += " -frame ";
             argsString += time;
 
@@ -370,10 +478,28 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
             }
 
             AiNodeSetStr(node, "data", argsString.asChar());
+
+            WatchFiles(abcFile, cacheLayers);
             // AiNodeSetBool( node, "load_at_init", loadAtInit ); 
 
             ExportUserAttrs(node);
 
+            // older procedurals instance on their own and never read the groups
+            if (!instanceGroups.empty() && GpuCacheProceduralSupports( "instancegroups" ))
+            {
+                    AtArray* groups = AiArrayAllocate( (unsigned int)instanceGroups.size(), 1, AI_TYPE_STRING );
+                    for (size_t i = 0; i < instanceGroups.size(); ++i)
+                            AiArraySetStr( groups, (unsigned int)i, instanceGroups[i].c_str() );
+                    AiNodeDeclare( node, "instanceGroups", "constant ARRAY STRING" );
+                    AiNodeSetArray( node, "instanceGroups", groups );
+            }
+
+            plug = FindMayaPlug( "compileOverrides" );
+            if (!plug.isNull() && plug.asBool())
+            {
+                    ExportOperatorGraph(node);
+            }
+
             // export curve attributes
             ExportCurveAttrs(node);
 
@@ -383,6 +509,456 @@ void GpuCacheTranslator::ExportProcedural( AtNode *node, bool update)
         } 
 }
 
+int GpuCacheTranslator::AdaptiveSubDIterations( const MBoundingBox& bound )
+{
+        int minIterations = 0;
+        MPlug plug = FindMayaPlug( "subDMinIterations" );
+        if (!plug.isNull() )
+        {
+                minIterations = plug.asInt();
+        }
+
+        int maxIterations = 2;
+        plug = FindMayaPlug( "subDMaxIterations" );
+        if (!plug.isNull() )
+        {
+                maxIterations = plug.asInt();
+        }
+
+        // take the whole shutter into account, a fast move towards the
+        // camera should get the detail of its closest position
+        const std::vector<double> frames = RequiresMotionData() ?
+                SceneMotionFrames() : std::vector<double>(1, MAnimControl::currentTime().as(MTime::uiUnit()));
+
+        float screenSize = GpuCacheProjectedSize( m_dagPath, bound, GetSessionOptions().GetCamera(), frames );
+        int iterations = GpuCacheAdaptiveIterations( screenSize, minIterations, maxIterations );
+
+        GpuCacheMemoryParams params = GpuCacheMemoryParams::FromNode( m_dagPath, 1 );
+        params.subDIterations = iterations;
+        GpuCacheMemoryEstimate estimate = GpuCacheEstimateMemory( params );
+
+        if (estimate.valid)
+                GPUCACHE_REPORT_DEBUG("%s: adaptive subdivision, %.0f pixels on screen -> %d iterations, %llu polygons",
+                                     m_dagPath.partialPathName().asChar(), screenSize, iterations, estimate.polygons);
+        else
+                GPUCACHE_REPORT_DEBUG("%s: adaptive subdivision, %.0f pixels on screen -> %d iterations",
+                                     m_dagPath.partialPathName().asChar(), screenSize, iterations);
+        return iterations;
+}
+
+unsigned int GpuCacheTranslator::MotionKeys()
+{
+        return RequiresMotionData() ? SceneMotionKeys() : 1;
+}
+
+std::vector<double> GpuCacheTranslator::SceneMotionFrames()
+{
+        std::vector<double> frames;
+        if (IsMotionBlurEnabled( MTOA_MBLUR_OBJECT ))
+        {
+                unsigned int count = 0;
+                const double* motionFrames = GetMotionFrames(count);
+                frames.assign(motionFrames, motionFrames + count);
+        }
+        if (frames.empty())
+                frames.push_back(MAnimControl::currentTime().as(MTime::uiUnit()));
+        return frames;
+}
+
+unsigned int GpuCacheTranslator::SceneMotionKeys()
+{
+        return (unsigned int)SceneMotionFrames().size();
+}
+
+int GpuCacheTranslator::ApplyMemoryBudget( int subDIterations )
+{
+        const unsigned int motionKeys = MotionKeys();
+        const GpuCacheBudget& budget = GpuCacheBudget::Get( SceneMotionKeys() );
+
+        GpuCacheMemoryParams params = GpuCacheMemoryParams::FromNode( m_dagPath, motionKeys );
+        params.subDIterations = subDIterations;
+        GpuCacheMemoryEstimate estimate = GpuCacheEstimateMemory( params );
+
+        if (!estimate.valid)
+        {
+                GPUCACHE_LOG_WARNING("%s: no memory forecast, %s could not be read",
+                                        m_dagPath.partialPathName().asChar(), params.filename.c_str());
+                return GpuCacheBudget::kKeep;
+        }
+
+        GPUCACHE_REPORT_DEBUG("%s: %u objects, %llu polygons at %d subdivision iterations, %u motion keys, forecast %s",
+                             m_dagPath.partialPathName().asChar(), estimate.objects, estimate.polygons,
+                             subDIterations, motionKeys, GpuCacheFormatBytes(estimate.bytes).c_str());
+
+        const GpuCacheBudget::Node* sceneNode = budget.Find( m_dagPath );
+        if (sceneNode && sceneNode->action != GpuCacheBudget::kKeep)
+                return sceneNode->action;
+
+        float nodeBudget = 0.0f;
+        MPlug plug = FindMayaPlug( "memoryBudget" );
+        if (!plug.isNull() )
+        {
+                nodeBudget = plug.asFloat();
+        }
+
+        if (nodeBudget <= 0.0f || estimate.bytes <= (unsigned long long)(nodeBudget * 1048576.0f))
+                return GpuCacheBudget::kKeep;
+
+        if (budget.GetPolicy() == GpuCacheBudget::kWarn)
+        {
+                GPUCACHE_LOG_WARNING("%s: forecast %s exceeds the node budget of %.0f MB",
+                                        m_dagPath.partialPathName().asChar(), GpuCacheFormatBytes(estimate.bytes).c_str(), nodeBudget);
+                return GpuCacheBudget::kKeep;
+        }
+
+        bool hasProxy = sceneNode && sceneNode->hasProxy;
+        if (sceneNode == NULL && budget.GetPolicy() == GpuCacheBudget::kProxy)
+        {
+                // no scene forecast, check the proxy of this node alone
+                GpuCacheMemoryParams proxyParams;
+                proxyParams.filename = FindMayaPlug( "proxyCacheFileName" ).asString().expandEnvironmentVariablesAndTilde().asChar();
+                proxyParams.objectPath = FindMayaPlug( "proxyGeomPath" ).asString().asChar();
+                proxyParams.motionKeys = motionKeys;
+                hasProxy = !proxyParams.filename.empty() && GpuCacheEstimateMemory( proxyParams ).valid;
+        }
+        bool useProxy = budget.GetPolicy() == GpuCacheBudget::kProxy && hasProxy;
+        GPUCACHE_LOG_WARNING("%s: forecast %s exceeds the node budget of %.0f MB, %s",
+                                m_dagPath.partialPathName().asChar(), GpuCacheFormatBytes(estimate.bytes).c_str(), nodeBudget,
+                                useProxy ? "using its proxy" : "disabling it");
+        return useProxy ? GpuCacheBudget::kUseProxy : GpuCacheBudget::kDisabled;
+}
+
+bool GpuCacheTranslator::DetectInstances( const MString& abcFile,
+                                          const MString& cacheLayers,
+                                          const MString& objectPath,
+                                          const MString& objectPattern,
+                                          const MString& excludePattern,
+                                          int subDIterations,
+                                          std::vector<std::string>& instanceGroups )
+{
+        MPlug plug = FindMayaPlug( "autoInstance" );
+        if (plug.isNull() || !plug.asBool())
+                return false;
+
+        float threshold = 64.0f;
+        plug = FindMayaPlug( "autoInstanceThreshold" );
+        if (!plug.isNull() )
+        {
+                threshold = plug.asFloat();
+        }
+
+        GpuCacheMemoryParams params;
+        params.filename = abcFile.asChar();
+        params.layers = GpuCacheSplitLayers( cacheLayers.asChar() );
+        params.objectPath = objectPath.asChar();
+        params.pattern = objectPattern.asChar();
+        params.excludePattern = excludePattern.asChar();
+        params.subDIterations = subDIterations;
+        params.motionKeys = MotionKeys();
+
+        GpuCacheInstanceGroups found = GpuCacheFindInstances( params );
+        const bool enable = found.instances > 0 &&
+                            found.savedBytes >= (unsigned long long)(threshold * 1048576.0f);
+
+        GPUCACHE_REPORT_DEBUG("%s: %u unique shapes, %u instances, instancing would save %s%s",
+                             m_dagPath.partialPathName().asChar(), found.uniqueShapes, found.instances,
+                             GpuCacheFormatBytes(found.savedBytes).c_str(),
+                             enable ? ", instancing enabled" : "");
+
+        if (!enable)
+                return false;
+
+        // one entry per group, the object paths separated by ';'
+        for (size_t i = 0; i < found.groups.size(); ++i)
+        {
+                std::string group;
+                for (size_t j = 0; j < found.groups[i].size(); ++j)
+                {
+                        if (j > 0)
+                                group += ';';
+                        group += found.groups[i][j];
+                }
+                instanceGroups.push_back(group);
+        }
+        return true;
+}
+
+void GpuCacheTranslator::ExportRenderFlags( AtNode *node )
+{
+        AiNodeSetInt( node, "visibility", ComputeVisibility() );
+
+        MPlug plug = FindMayaPlug( "receiveShadows" );
+        if( !plug.isNull() )
+        {
+                AiNodeSetBool( node, "receive_shadows", plug.asBool() );
+        }
+
+        plug = FindMayaPlug( "aiSelfShadows" );
+        if( !plug.isNull() )
+        {
+                AiNodeSetBool( node, "self_shadows", plug.asBool() );
+        }
+
+        plug = FindMayaPlug( "aiOpaque" );
+        if( !plug.isNull() )
+        {
+                AiNodeSetBool( node, "opaque", plug.asBool() );
+        }
+
+        MStatus status;
+        MFnDependencyNode dnode(m_dagPath.node(), &status);
+        if (status)
+            AiNodeSetInt(node, "id", DJB2Hash((unsigned char*)dnode.name().asChar()));
+}
+
+void GpuCacheTranslator::WatchFiles( const MString& abcFile, const MString& cacheLayers )
+{
+        if (GetSessionMode() != MTOA_SESSION_IPR)
+                return;
+
+        std::vector<std::string> paths = GpuCacheSplitLayers( cacheLayers.asChar() );
+        paths.insert(paths.begin(), abcFile.asChar());
+
+        const char* fileAttributes[] = { "shaderAssignmentfile", "overridefile",
+                                         "userAttributesfile", "assShaders" };
+        for (size_t i = 0; i < sizeof(fileAttributes) / sizeof(fileAttributes[0]); ++i)
+        {
+                MPlug plug = FindMayaPlug( fileAttributes[i] );
+                if (!plug.isNull())
+                        paths.push_back(plug.asString().expandEnvironmentVariablesAndTilde().asChar());
+        }
+
+        GpuCacheFileWatcher::Instance().Watch( this, paths );
+}
+
+bool GpuCacheTranslator::UseInMemoryGeometry()
+{
+        m_memoryBuffers.clear();
+
+        if (GetSessionMode() != MTOA_SESSION_IPR)
+                return false;
+
+        MPlug plug = FindMayaPlug( "iprInMemory" );
+        if (plug.isNull() || !plug.asBool())
+                return false;
+
+        // ginstances only point at a single node
+        if (m_dagPath.isInstanced())
+                return false;
+
+        // Layers, patterns, per-object assignments and ass shaders are resolved
+        // by the procedural while it walks the archive, so those nodes keep using it.
+        const char* proceduralOnly[] = { "cacheLayers", "objectPattern", "excludePattern",
+                                         "shaderAssignation", "displacementAssignation",
+                                         "shaderAssignmentfile", "overrides", "overridefile",
+                                         "userAttributes", "userAttributesfile", "assShaders" };
+        for (size_t i = 0; i < sizeof(proceduralOnly) / sizeof(proceduralOnly[0]); ++i)
+        {
+                plug = FindMayaPlug( proceduralOnly[i] );
+                if (!plug.isNull() && plug.asString() != "")
+                        return false;
+        }
+
+        // The viewport keeps triangulated, static topology: anything the
+        // procedural would change about the geometry must go through it too.
+        plug = FindMayaPlug( "namePrefix" );
+        if (!plug.isNull() && plug.asString() != "")
+                return false;
+
+        const char* geometryFlags[] = { "subDAdaptive", "makeInstance", "flipv", "invertNormals" };
+        for (size_t i = 0; i < sizeof(geometryFlags) / sizeof(geometryFlags[0]); ++i)
+        {
+                plug = FindMayaPlug( geometryFlags[i] );
+                if (!plug.isNull() && plug.asBool())
+                        return false;
+        }
+
+        plug = FindMayaPlug( "ai_subDIterations" );
+        if (!plug.isNull() && plug.asInt() != 0)
+                return false;
+
+        // only the transform would be keyed
+        if (IsMotionBlurEnabled( MTOA_MBLUR_DEFORM ) && IsLocalMotionBlurEnabled())
+                return false;
+
+        unsigned instNumber = m_dagPath.isInstanced() ? m_dagPath.instanceNumber() : 0;
+        MPlug shadingGroupPlug = GetNodeShadingGroup(m_dagPath.node(), instNumber);
+        if (!shadingGroupPlug.isNull())
+        {
+                MPlugArray connections;
+                MFnDependencyNode(shadingGroupPlug.node()).findPlug("displacementShader").connectedTo(connections, true, false);
+                if (connections.length() > 0)
+                        return false;
+        }
+
+        float frame = 0.0;
+        plug = FindMayaPlug( "frame" );
+        if (!plug.isNull() )
+        {
+                frame = plug.asFloat();
+        }
+
+        float timeOffset = 0.0;
+        plug = FindMayaPlug( "timeOffset" );
+        if (!plug.isNull() )
+        {
+                timeOffset = plug.asFloat();
+        }
+
+        std::unique_ptr<GpuCacheGeometrySource> source =
+                GpuCacheGeometrySource::FromGpuCacheNode( m_dagPath, MTime(frame + timeOffset, MTime::uiUnit()) );
+        if (!source || !source->IsAvailable())
+                return false;
+
+        source->GetBuffers( m_memoryBuffers );
+        if (m_memoryBuffers.empty())
+                return false;
+
+        GPUCACHE_LOG_DEBUG("%s: exporting %d shapes from memory",
+                           m_dagPath.partialPathName().asChar(), (int)m_memoryBuffers.size());
+        return true;
+}
+
+void GpuCacheTranslator::UseBatch()
+{
+        m_batch.reset();
+        m_batchEntry = 0;
+        m_batchIndex = -1;
+        m_batchLeader = false;
+
+        if (GetSessionMode() == MTOA_SESSION_IPR)
+                return;
+
+        MPlug plug = FindMayaPlug( "batchByArchive" );
+        if (plug.isNull() || !plug.asBool())
+                return;
+
+        m_batch = GpuCacheBatches::Get( SceneMotionFrames() ).Find( m_dagPath, m_batchEntry );
+}
+
+void GpuCacheTranslator::AppendToBatch()
+{
+        AtNode* node = m_batch->procedural;
+        const unsigned int capacity = (unsigned int)m_batch->entries.size();
+
+        // whichever member comes first declares the arrays, sized for them all
+        if (AiNodeLookUpUserParameter( node, "batchCount" ) == NULL)
+        {
+                AiNodeDeclare( node, "batchCount", "constant INT" );
+                AiNodeDeclare( node, "batchPaths", "constant ARRAY STRING" );
+                AiNodeSetArray( node, "batchPaths", AiArrayAllocate( capacity, 1, AI_TYPE_STRING ) );
+                AiNodeDeclare( node, "batchTimes", "constant ARRAY FLOAT" );
+                AiNodeSetArray( node, "batchTimes", AiArrayAllocate( capacity, 1, AI_TYPE_FLOAT ) );
+                AiNodeDeclare( node, "batchIds", "constant ARRAY INT" );
+                AiNodeSetArray( node, "batchIds", AiArrayAllocate( capacity, 1, AI_TYPE_INT ) );
+
+                // entry major: the keys of entry i start at i * motionKeys
+                AiNodeDeclare( node, "batchMatrices", "constant ARRAY MATRIX" );
+                AiNodeSetArray( node, "batchMatrices", AiArrayAllocate( capacity * MotionKeys(), 1, AI_TYPE_MATRIX ) );
+
+                AiNodeSetVec( node, "min", AI_BIG, AI_BIG, AI_BIG );
+                AiNodeSetVec( node, "max", -AI_BIG, -AI_BIG, -AI_BIG );
+        }
+
+        if (m_batchIndex >= 0 || m_batch->count >= capacity || m_batchEntry >= capacity)
+        {
+                GPUCACHE_LOG_WARNING("%s: already appended or no room left in the batch led by %s",
+                                     m_dagPath.partialPathName().asChar(), AiNodeGetName( node ));
+                return;
+        }
+
+        // only the first batchCount entries are filled, the procedural reads those
+        const GpuCacheBatchEntry& entry = m_batch->entries[m_batchEntry];
+        m_batchIndex = (int)m_batch->count++;
+        AiNodeSetInt( node, "batchCount", (int)m_batch->count );
+        AiArraySetStr( AiNodeGetArray( node, "batchPaths" ), m_batchIndex, entry.objectPath.c_str() );
+        AiArraySetFlt( AiNodeGetArray( node, "batchTimes" ), m_batchIndex, entry.time );
+        MFnDependencyNode dnode( m_dagPath.node() );
+        AiArraySetInt( AiNodeGetArray( node, "batchIds" ), m_batchIndex, DJB2Hash((unsigned char*)dnode.name().asChar()) );
+        ExportBatchMatrix();
+
+        AtVector min = AiNodeGetVec( node, "min" );
+        AtVector max = AiNodeGetVec( node, "max" );
+        AiNodeSetVec( node, "min", std::min( min.x, float(entry.bound.min().x) - m_dispPadding ),
+                                   std::min( min.y, float(entry.bound.min().y) - m_dispPadding ),
+                                   std::min( min.z, float(entry.bound.min().z) - m_dispPadding ) );
+        AiNodeSetVec( node, "max", std::max( max.x, float(entry.bound.max().x) + m_dispPadding ),
+                                   std::max( max.y, float(entry.bound.max().y) + m_dispPadding ),
+                                   std::max( max.z, float(entry.bound.max().z) + m_dispPadding ) );
+
+        GPUCACHE_LOG_DEBUG("%s: entry %d of the batch led by %s", m_dagPath.partialPathName().asChar(),
+                           m_batchIndex, AiNodeGetName( node ));
+}
+
+void GpuCacheTranslator::ExportBatchMatrix()
+{
+        AtNode* node = m_batch->procedural;
+        AtArray* matrices = AiNodeGetArray( node, "batchMatrices" );
+        if (matrices == NULL || m_batchIndex < 0)
+                return;
+
+        const unsigned int keys = AiArrayGetNumElements(matrices) / (unsigned int)m_batch->entries.size();
+        const unsigned int key = GetMotionStep();
+        if (key >= keys)
+                return;
+
+        AiArraySetMtx( matrices, m_batchIndex * keys + key, m_batch->entries[m_batchEntry].WorldMatrix() );
+}
+
+AtNode* GpuCacheTranslator::GetInMemoryNode( AtNode *root, size_t i )
+{
+        if (i == 0)
+                return root;
+        MString tag = "mem";
+        tag += (unsigned int)i;
+        return GetArnoldNode( tag.asChar() );
+}
+
+void GpuCacheTranslator::ApplyLocalMatrix( AtNode *node, const AtMatrix& local )
+{
+        AtArray* matrices = AiNodeGetArray( node, "matrix" );
+        unsigned int key = GetMotionStep();
+        if (matrices == NULL || key >= AiArrayGetNumKeys(matrices))
+                return;
+        AiArraySetMtx( matrices, key, AiM4Mult(local, AiArrayGetMtx(matrices, key)) );
+}
+
+void GpuCacheTranslator::ExportInMemory( AtNode *root )
+{
+        GPUCACHE_LOG_DEBUG("ExportInMemory()");
+
+        AtNode* shader = arnoldShader(root);
+
+        WatchFiles( FindMayaPlug( "cacheFileName" ).asString().expandEnvironmentVariablesAndTilde() );
+
+        for (size_t i = 0; i < m_memoryBuffers.size(); ++i)
+        {
+                AtNode* node = GetInMemoryNode(root, i);
+                if (node == NULL)
+                        continue;
+
+                if (!GpuCacheExportBuffers( m_memoryBuffers[i], node ))
+                {
+                        GPUCACHE_LOG_WARNING("%s: incomplete in-memory shape %s",
+                                             m_dagPath.partialPathName().asChar(), m_memoryBuffers[i].name.c_str());
+                        AiNodeSetInt( node, "visibility", 0 );
+                        continue;
+                }
+
+                ExportMatrix( node );
+                ApplyLocalMatrix( node, m_memoryBuffers[i].localMatrix );
+
+                ExportRenderFlags( node );
+                AiNodeSetPtr( node, "shader", shader );
+
+                // same user data the procedural would pass to its shapes
+                ExportUserAttrs( node );
+                ExportCurveAttrs( node );
+
+                ExportLightLinking( node );
+        }
+}
+
 void GpuCacheTranslator::ExportUserAttrs( AtNode *node )
 {
         // Get the optional attributes and export them as user vars
@@ -502,6 +1078,51 @@ void GpuCacheTranslator::ExportUserAttrs( AtNode *node )
 
 }
 
+void GpuCacheTranslator::ExportOperatorGraph( AtNode *node )
+{
+        if (!GpuCacheOperatorGraph::Supported(node))
+        {
+                GPUCACHE_LOG_DEBUG("%s: procedurals take no operators, overrides stay with the procedural",
+                                   m_dagPath.partialPathName().asChar());
+                return;
+        }
+
+        MPlug plug = FindMayaPlug( "skipJson" );
+        if (!plug.isNull() && plug.asBool())
+                return;
+
+        plug = FindMayaPlug( "skipOverrides" );
+        const bool skipOverrides = !plug.isNull() && plug.asBool();
+        plug = FindMayaPlug( "skipUserAttributes" );
+        const bool skipUserAttributes = !plug.isNull() && plug.asBool();
+
+        GpuCacheOperatorSources sources;
+        if (!skipOverrides)
+        {
+                sources.overrides = FindMayaPlug( "overrides" ).asString().asChar();
+                sources.overrideFile = FindMayaPlug( "overridefile" ).asString().expandEnvironmentVariablesAndTilde().asChar();
+        }
+        if (!skipUserAttributes)
+        {
+                sources.userAttributes = FindMayaPlug( "userAttributes" ).asString().asChar();
+                sources.userAttributesFile = FindMayaPlug( "userAttributesfile" ).asString().expandEnvironmentVariablesAndTilde().asChar();
+        }
+        sources.namePrefix = FindMayaPlug( "namePrefix" ).asString().asChar();
+
+        AtNode* graph = GpuCacheOperatorGraph::Get( sources );
+        // nothing compiled: the procedural keeps applying the dictionaries
+        if (graph == NULL)
+                return;
+
+        AiNodeSetPtr( node, "operator", graph );
+
+        // Arnold applies them now, the procedural must not do it a second time
+        if (!skipOverrides)
+                AiNodeSetBool( node, "skipOverrides", true );
+        if (!skipUserAttributes)
+                AiNodeSetBool( node, "skipUserAttributes", true );
+}
+
 void GpuCacheTranslator::ExportCurveAttrs( AtNode *node )
 {
         MPlug plug = FindMayaPlug( "radiusCurve" );
@@ -539,6 +1160,25 @@ void GpuCacheTranslator::ExportMotion( AtNode *node )
                 return;
         }
 
+        if (m_inMemory)
+        {
+                for (size_t i = 0; i < m_memoryBuffers.size(); ++i)
+                {
+                        AtNode* memNode = GetInMemoryNode(node, i);
+                        if (memNode == NULL)
+                                continue;
+                        ExportMatrix( memNode );
+                        ApplyLocalMatrix( memNode, m_memoryBuffers[i].localMatrix );
+                }
+                return;
+        }
+
+        if (m_batch)
+        {
+                ExportBatchMatrix();
+                return;
+        }
+
         ExportMatrix( node );
 }
 
@@ -703,6 +1343,76 @@ void GpuCacheTranslator::nodeInitialiser( CAbTranslator context )
         data.name = "loadAtInit";
         data.shortName = "load_at_init";
         helper.MakeInputBoolean(data);      
+
+        data.defaultValue.BOOL() = false;
+        data.name = "subDAdaptive";
+        data.shortName = "subd_adaptive";
+        helper.MakeInputBoolean(data);
+
+        data.defaultValue.INT() = 0;
+        data.name = "subDMinIterations";
+        data.shortName = "subd_min_iterations";
+        data.hasMin = true;
+        data.min.INT() = 0;
+        data.hasSoftMax = true;
+        data.softMax.INT() = 6;
+        helper.MakeInputInt(data);
+
+        data.defaultValue.INT() = 2;
+        data.name = "subDMaxIterations";
+        data.shortName = "subd_max_iterations";
+        data.hasMin = true;
+        data.min.INT() = 0;
+        data.hasSoftMax = true;
+        data.softMax.INT() = 6;
+        helper.MakeInputInt(data);
+        data.hasMin = false;
+        data.hasSoftMax = false;
+
+        data.defaultValue.FLT() = 0.0f;
+        data.name = "memoryBudget";
+        data.shortName = "memory_budget";
+        helper.MakeInputFloat(data);
+
+        data.defaultValue.STR() = AtString("");
+        data.name = "proxyCacheFileName";
+        data.shortName = "proxy_cache_file_name";
+        helper.MakeInputString ( data );
+
+        data.defaultValue.STR() = AtString("");
+        data.name = "proxyGeomPath";
+        data.shortName = "proxy_geom_path";
+        helper.MakeInputString ( data );
+
+        data.defaultValue.BOOL() = false;
+        data.name = "autoInstance";
+        data.shortName = "auto_instance";
+        helper.MakeInputBoolean(data);
+
+        data.defaultValue.FLT() = 64.0f;
+        data.name = "autoInstanceThreshold";
+        data.shortName = "auto_instance_threshold";
+        helper.MakeInputFloat(data);
+
+        data.defaultValue.BOOL() = false;
+        data.name = "compileOverrides";
+        data.shortName = "compile_overrides";
+        helper.MakeInputBoolean(data);
+
+        data.defaultValue.STR() = AtString("");
+        data.name = "cacheLayers";
+        data.shortName = "cache_layers";
+        helper.MakeInputString ( data );
+
+        data.defaultValue.BOOL() = false;
+        data.name = "batchByArchive";
+        data.shortName = "batch_by_archive";
+        helper.MakeInputBoolean(data);
+
+        data.defaultValue.BOOL() = false;
+        data.name = "iprInMemory";
+        data.shortName = "ipr_in_memory";
+        helper.MakeInputBoolean(data);
 }
 
 
@@ -754,7 +1464,7 @@ AtNode* GpuCacheTranslator::arnoldShader(AtNode* node)
   // Only export displacement attributes if a displacement is applied
   if (m_displaced)
   {
-      std::cout << "arnoldShader::m_displaced :: " << m_displaced << std::endl;
+      GPUCACHE_LOG_DEBUG("%s: displacement found", m_dagPath.partialPathName().asChar());
      // Note that disp_height has no actual influence on the scale of the displacement if it is vector based
      // it only influences the computation of the displacement bounds
     // AiNodeSetFlt(node, "disp_padding", maximumDisplacementPadding);
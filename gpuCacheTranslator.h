@@ -11,10 +11,20 @@
 #include <Alembic/AbcCoreAbstract/Foundation.h>
 #include "translators/shape/ShapeTranslator.h"
 
+#include "gpuCacheBuffers.h"
+#include "gpuCacheBatching.h"
+
+#include <maya/MBoundingBox.h>
+
+#include <string>
+#include <vector>
+
 class GpuCacheTranslator : public CShapeTranslator
 {
 public :
 
+        virtual ~GpuCacheTranslator();
+
         AtNode* CreateArnoldNodes();
 
         virtual void Delete();
@@ -26,10 +36,18 @@ public :
 
         virtual void ExportProcedural( AtNode *node, bool update);
 
+        /// IPR fast path: export the geometry the gpuCache node already holds
+        /// in memory as shape nodes, instead of an alembic_loader procedural.
+        virtual void ExportInMemory( AtNode *node );
+
         virtual void ExportUserAttrs( AtNode *node );
 
         virtual void ExportCurveAttrs( AtNode *node );
 
+        /// Attaches the shared set_parameter chain compiled from the node's
+        /// overrides and user attributes to the procedural.
+        virtual void ExportOperatorGraph( AtNode *node );
+
         virtual bool RequiresMotionData();
 
         virtual void ExportMotion( AtNode *node );
@@ -43,6 +61,66 @@ public :
 
 protected :
 
+        /// True when this node can be exported from the gpuCache in-memory
+        /// geometry. Fills m_memoryBuffers as a side effect.
+        bool UseInMemoryGeometry();
+
+        /// Looks the node up in the scene's batches (outside IPR, with
+        /// batchByArchive on) and sets m_batch when it may join one.
+        void UseBatch();
+
+        /// Appends this node's object path, time, id, world matrix and bound
+        /// to its batch's procedural, declaring the arrays when first.
+        void AppendToBatch();
+
+        /// Writes this node's world matrix for the current motion step into
+        /// its batch's procedural.
+        void ExportBatchMatrix();
+
+        /// Arnold node holding the i-th in-memory buffer.
+        AtNode* GetInMemoryNode( AtNode *root, size_t i );
+
+        /// Composes the buffer's local transform onto the matrix key that
+        /// ExportMatrix just wrote.
+        void ApplyLocalMatrix( AtNode *node, const AtMatrix& local );
+
+        void ExportRenderFlags( AtNode *node );
+
+        /// During IPR, registers the archive, its layers and every JSON / ass
+        /// file the node reads with the file watcher, so edits on disk update it.
+        void WatchFiles( const MString& abcFile, const MString& cacheLayers = "" );
+
+        /// Subdivision iterations picked from the node's size on screen
+        /// between its min and max iterations. Logs the choice.
+        int AdaptiveSubDIterations( const MBoundingBox& bound );
+
+        /// Number of motion keys the node will be exported with.
+        unsigned int MotionKeys();
+
+        /// Object motion blur frames of the session, whatever the node's own
+        /// motionBlur, or just the current frame without object blur.
+        std::vector<double> SceneMotionFrames();
+
+        /// Number of SceneMotionFrames(). Keys the scene wide forecast.
+        unsigned int SceneMotionKeys();
+
+        /// Logs the node's memory forecast and returns the
+        /// GpuCacheBudget::Action the scene and node budgets ask for.
+        int ApplyMemoryBudget( int subDIterations );
+
+        /// Looks for duplicate geometry among the selected objects. Returns
+        /// true, with the duplicate groups, when instancing them is forecast
+        /// to save more than autoInstanceThreshold MB. Only runs on nodes with
+        /// autoInstance turned on, off by default so existing scenes keep
+        /// their arguments.
+        bool DetectInstances( const MString& abcFile,
+                              const MString& cacheLayers,
+                              const MString& objectPath,
+                              const MString& objectPattern,
+                              const MString& excludePattern,
+                              int subDIterations,
+                              std::vector<std::string>& instanceGroups );
+
         void GetDisplacement(MObject& obj,
                              float& dispPadding,
                              bool& enableAutoBump);
@@ -60,6 +138,12 @@ protected :
         MDagPath m_dagPathRef;
         MDagPath m_masterDag;
         AtNode* m_dispNode;
+        bool m_inMemory;
+        std::vector<GpuCacheBuffers> m_memoryBuffers;
+        std::shared_ptr<GpuCacheBatch> m_batch;
+        size_t m_batchEntry;            // index in m_batch->entries
+        int m_batchIndex;               // index in the procedural's arrays, -1 until appended
+        bool m_batchLeader;
 };
 
 
@@ -0,0 +1,478 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheWatcher.cpp
+ *
+ *  IPR file watcher for gpuCache translators.
+ */
+
+#include "gpuCacheWatcher.h"
+#include "gpuCacheTranslator.h"
+#include "gpuCacheLog.h"
+
+#include <maya/MTimerMessage.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <climits>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#endif
+
+#include <chrono>
+#include <cstdlib>
+
+namespace
+{
+
+const float kTimerPeriod = 0.25f;       // seconds between checks
+const double kDebounce = 0.5;           // quiet time before a change is acted on
+const double kPollInterval = 2.0;
+
+double nowSeconds()
+{
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string directoryOf( const std::string& path )
+{
+        std::string::size_type slash = path.rfind('/');
+        if (slash == std::string::npos)
+                return ".";
+        if (slash == 0)
+                return "/";
+        return path.substr(0, slash);
+}
+
+std::string baseNameOf( const std::string& path )
+{
+        std::string::size_type slash = path.rfind('/');
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+std::string joinPath( const std::string& directory, const std::string& name )
+{
+        return directory == "/" ? "/" + name : directory + "/" + name;
+}
+
+/// Absolute path with "//", "." and ".." removed, symlinks left in place.
+std::string absolutePath( const std::string& path )
+{
+        std::string full = path;
+        if (full.empty() || full[0] != '/')
+        {
+                char cwd[PATH_MAX];
+                if (getcwd(cwd, sizeof(cwd)) != NULL)
+                        full = std::string(cwd) + "/" + full;
+        }
+
+        std::vector<std::string> parts;
+        std::string::size_type start = 0;
+        while (start <= full.size())
+        {
+                std::string::size_type end = full.find('/', start);
+                if (end == std::string::npos)
+                        end = full.size();
+                std::string part = full.substr(start, end - start);
+                if (part == "..")
+                {
+                        if (!parts.empty())
+                                parts.pop_back();
+                }
+                else if (!part.empty() && part != ".")
+                {
+                        parts.push_back(part);
+                }
+                start = end + 1;
+        }
+
+        std::string result;
+        for (size_t i = 0; i < parts.size(); ++i)
+                result += "/" + parts[i];
+        return result.empty() ? "/" : result;
+}
+
+/// The file's real location: realpath of the file, or of its directory when
+/// the file does not exist (yet).
+std::string resolvedPath( const std::string& path )
+{
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved) != NULL)
+                return resolved;
+        if (realpath(directoryOf(path).c_str(), resolved) != NULL)
+                return joinPath(resolved, baseNameOf(path));
+        return path;
+}
+
+/// Network file systems accept inotify watches but never report changes
+/// made by other hosts.
+bool isNetworkFileSystem( const std::string& directory )
+{
+#ifdef __linux__
+        struct statfs fs;
+        if (statfs(directory.c_str(), &fs) != 0)
+                return false;
+        switch ((unsigned long)fs.f_type)
+        {
+          case 0x6969:          // NFS
+          case 0x517B:          // SMB
+          case 0xFF534D42:      // CIFS
+          case 0xFE534D42:      // SMB2
+          case 0x5346414F:      // AFS
+          case 0x65735546:      // FUSE (sshfs, ...)
+          case 0x0BD00BD0:      // Lustre
+          case 0x47504653:      // GPFS
+          case 0x00C36400:      // Ceph
+            return true;
+          default :
+            return false;
+        }
+#else
+        return true;
+#endif
+}
+
+/// Files dropped in place with their original time stamp still get a new
+/// inode, so all three are compared. Times are kept to the nanosecond, a
+/// rewrite within the same second still shows.
+bool statFile( const std::string& path, long long& modified, long long& size, long long& inode )
+{
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+        {
+                modified = 0;
+                size = -1;
+                inode = 0;
+                return false;
+        }
+#ifdef __APPLE__
+        modified = (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+        modified = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+        size = st.st_size;
+        inode = (long long)st.st_ino;
+        return true;
+}
+
+} // namespace
+
+
+GpuCacheFileWatcher& GpuCacheFileWatcher::Instance()
+{
+        static GpuCacheFileWatcher watcher;
+        return watcher;
+}
+
+GpuCacheFileWatcher::GpuCacheFileWatcher()
+        : m_inotify(-1), m_polling(true), m_lastPoll(0.0), m_timer(0), m_hasTimer(false)
+{
+#ifdef __linux__
+        if (getenv("GPUCACHE_WATCH_POLL") == NULL)
+        {
+                m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                m_polling = m_inotify < 0;
+        }
+#endif
+        if (m_polling)
+                GPUCACHE_LOG_DEBUG("file watcher polling every %.0f seconds", kPollInterval);
+}
+
+void GpuCacheFileWatcher::Watch( GpuCacheTranslator* translator, const std::vector<std::string>& paths )
+{
+        Unwatch( translator );
+
+        std::vector<std::string>& watched = m_translators[translator];
+        for (size_t i = 0; i < paths.size(); ++i)
+        {
+                if (paths[i].empty())
+                        continue;
+                const std::string path = absolutePath(paths[i]);
+
+                std::map<std::string, FileState>::iterator it = m_files.find(path);
+                if (it == m_files.end())
+                {
+                        it = m_files.insert(std::make_pair(path, FileState())).first;
+                        FileState& state = it->second;
+                        statFile( path, state.modified, state.size, state.inode );
+                        state.polled = !addWatches( path, state ) ||
+                                       isNetworkFileSystem( directoryOf(resolvedPath(path)) );
+                        if (state.polled)
+                                GPUCACHE_LOG_DEBUG("polling %s", path.c_str());
+                }
+                it->second.dependents.insert(translator);
+                watched.push_back(path);
+        }
+
+        if (watched.empty())
+                m_translators.erase(translator);
+        else
+                startTimer();
+}
+
+void GpuCacheFileWatcher::Unwatch( GpuCacheTranslator* translator )
+{
+        std::map<GpuCacheTranslator*, std::vector<std::string> >::iterator it = m_translators.find(translator);
+        if (it == m_translators.end())
+                return;
+
+        for (size_t i = 0; i < it->second.size(); ++i)
+        {
+                std::map<std::string, FileState>::iterator file = m_files.find(it->second[i]);
+                if (file == m_files.end())
+                        continue;
+                file->second.dependents.erase(translator);
+                if (file->second.dependents.empty())
+                {
+                        removeWatches( file->first, file->second );
+                        m_files.erase(file);
+                }
+        }
+        m_translators.erase(it);
+
+        if (m_translators.empty())
+                stopTimer();
+}
+
+void GpuCacheFileWatcher::Shutdown()
+{
+        stopTimer();
+        m_files.clear();
+        m_translators.clear();
+        m_triggers.clear();
+        m_directories.clear();
+        m_watchedDirectories.clear();
+        if (m_inotify >= 0)
+        {
+                close(m_inotify);
+                m_inotify = -1;
+        }
+}
+
+bool GpuCacheFileWatcher::addWatches( const std::string& path, FileState& state )
+{
+        // the file itself, where it really is and where it was asked for
+        std::set<std::string> entries;
+        entries.insert(path);
+        entries.insert(resolvedPath(path));
+
+        // every symlink on the way, a new version published by repointing it
+        // shows as an entry changing in the link's parent directory
+        for (std::string::size_type slash = path.find('/', 1); slash != std::string::npos;
+             slash = path.find('/', slash + 1))
+        {
+                const std::string prefix = path.substr(0, slash);
+                struct stat st;
+                if (lstat(prefix.c_str(), &st) == 0 && S_ISLNK(st.st_mode))
+                        entries.insert(prefix);
+        }
+
+        // entries in the same directory share its watch
+        std::set<std::string> directories;
+        for (std::set<std::string>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+                directories.insert(directoryOf(*it));
+                m_triggers[*it].insert(path);
+                state.triggers.push_back(*it);
+        }
+
+        bool watched = true;
+        for (std::set<std::string>::const_iterator it = directories.begin(); it != directories.end(); ++it)
+        {
+                if (addDirectoryWatch( *it ))
+                        state.directories.push_back(*it);
+                else
+                        watched = false;
+        }
+        return watched;
+}
+
+void GpuCacheFileWatcher::removeWatches( const std::string& path, FileState& state )
+{
+        for (size_t i = 0; i < state.triggers.size(); ++i)
+        {
+                std::map<std::string, std::set<std::string> >::iterator trigger = m_triggers.find(state.triggers[i]);
+                if (trigger == m_triggers.end())
+                        continue;
+                trigger->second.erase(path);
+                if (trigger->second.empty())
+                        m_triggers.erase(trigger);
+        }
+        state.triggers.clear();
+
+        for (size_t i = 0; i < state.directories.size(); ++i)
+                releaseDirectoryWatch( state.directories[i] );
+        state.directories.clear();
+}
+
+bool GpuCacheFileWatcher::addDirectoryWatch( const std::string& directory )
+{
+#ifdef __linux__
+        if (m_inotify < 0)
+                return false;
+        std::map<std::string, DirectoryWatch>::iterator it = m_watchedDirectories.find(directory);
+        if (it != m_watchedDirectories.end())
+        {
+                ++it->second.references;
+                return true;
+        }
+
+        int wd = inotify_add_watch(m_inotify, directory.c_str(),
+                                   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB);
+        if (wd < 0)
+        {
+                // out of watches or an unwatchable file system
+                GPUCACHE_LOG_WARNING("cannot watch %s, polling instead", directory.c_str());
+                return false;
+        }
+        m_directories[wd].insert(directory);
+        DirectoryWatch watch = { wd, 1 };
+        m_watchedDirectories[directory] = watch;
+        return true;
+#else
+        return false;
+#endif
+}
+
+void GpuCacheFileWatcher::releaseDirectoryWatch( const std::string& directory )
+{
+#ifdef __linux__
+        std::map<std::string, DirectoryWatch>::iterator it = m_watchedDirectories.find(directory);
+        if (it == m_watchedDirectories.end() || --it->second.references > 0)
+                return;
+
+        std::map<int, std::set<std::string> >::iterator names = m_directories.find(it->second.descriptor);
+        if (names != m_directories.end())
+        {
+                names->second.erase(directory);
+                if (names->second.empty())
+                {
+                        // fails harmlessly when the directory is gone and the kernel dropped it
+                        if (m_inotify >= 0)
+                                inotify_rm_watch(m_inotify, names->first);
+                        m_directories.erase(names);
+                }
+        }
+        m_watchedDirectories.erase(it);
+#endif
+}
+
+void GpuCacheFileWatcher::startTimer()
+{
+        if (m_hasTimer)
+                return;
+        MStatus status;
+        m_timer = MTimerMessage::addTimerCallback(kTimerPeriod, timerCallback, this, &status);
+        m_hasTimer = status == MS::kSuccess;
+}
+
+void GpuCacheFileWatcher::stopTimer()
+{
+        if (!m_hasTimer)
+                return;
+        MMessage::removeCallback(m_timer);
+        m_hasTimer = false;
+}
+
+void GpuCacheFileWatcher::timerCallback( float, float, void* clientData )
+{
+        static_cast<GpuCacheFileWatcher*>(clientData)->update();
+}
+
+void GpuCacheFileWatcher::readEvents( double now )
+{
+#ifdef __linux__
+        if (m_inotify < 0)
+                return;
+
+        char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+        while (true)
+        {
+                ssize_t length = read(m_inotify, buffer, sizeof(buffer));
+                if (length <= 0)
+                        break;
+
+                for (char* p = buffer; p < buffer + length; )
+                {
+                        const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+                        p += sizeof(struct inotify_event) + event->len;
+
+                        std::map<int, std::set<std::string> >::const_iterator directories = m_directories.find(event->wd);
+                        if (directories == m_directories.end() || event->len == 0)
+                                continue;
+
+                        for (std::set<std::string>::const_iterator directory = directories->second.begin();
+                             directory != directories->second.end(); ++directory)
+                        {
+                                std::map<std::string, std::set<std::string> >::const_iterator trigger =
+                                        m_triggers.find( joinPath(*directory, event->name) );
+                                if (trigger == m_triggers.end())
+                                        continue;
+                                for (std::set<std::string>::const_iterator it = trigger->second.begin(); it != trigger->second.end(); ++it)
+                                {
+                                        std::map<std::string, FileState>::iterator file = m_files.find(*it);
+                                        if (file != m_files.end())
+                                                file->second.pendingSince = now;
+                                }
+                        }
+                }
+        }
+#endif
+}
+
+void GpuCacheFileWatcher::poll( double now )
+{
+        m_lastPoll = now;
+        for (std::map<std::string, FileState>::iterator it = m_files.begin(); it != m_files.end(); ++it)
+        {
+                if (!m_polling && !it->second.polled)
+                        continue;
+                long long modified, size, inode;
+                statFile( it->first, modified, size, inode );
+                if (modified != it->second.modified || size != it->second.size || inode != it->second.inode)
+                        it->second.pendingSince = now;
+        }
+}
+
+void GpuCacheFileWatcher::update()
+{
+        const double now = nowSeconds();
+
+        readEvents( now );
+        if (now - m_lastPoll >= kPollInterval)
+                poll( now );
+
+        std::set<GpuCacheTranslator*> changed;
+        for (std::map<std::string, FileState>::iterator it = m_files.begin(); it != m_files.end(); ++it)
+        {
+                FileState& state = it->second;
+                if (state.pendingSince == 0.0 || now - state.pendingSince < kDebounce)
+                        continue;
+
+                state.pendingSince = 0.0;
+                long long modified, size, inode;
+                statFile( it->first, modified, size, inode );
+                if (modified == state.modified && size == state.size && inode == state.inode)
+                        continue;       // touched but not changed
+                state.modified = modified;
+                state.size = size;
+                state.inode = inode;
+
+                // a repointed symlink leads somewhere else now
+                removeWatches( it->first, state );
+                state.polled = !addWatches( it->first, state ) ||
+                               isNetworkFileSystem( directoryOf(resolvedPath(it->first)) );
+
+                GPUCACHE_LOG_INFO("%s changed, updating %d gpuCache nodes",
+                                  it->first.c_str(), (int)state.dependents.size());
+                changed.insert(state.dependents.begin(), state.dependents.end());
+        }
+
+        // An update recreates the translator's nodes, which re-registers its
+        // files, so only call translators that are still watching.
+        for (std::set<GpuCacheTranslator*>::iterator it = changed.begin(); it != changed.end(); ++it)
+        {
+                if (m_translators.count(*it))
+                        (*it)->RequestUpdate();
+        }
+}
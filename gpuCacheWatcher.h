@@ -0,0 +1,94 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheWatcher.h
+ *
+ *  Watches the files gpuCache translators read during IPR and asks exactly
+ *  the translators depending on a changed file to update.
+ */
+
+#pragma once
+
+#include <maya/MMessage.h>
+
+#include <ctime>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class GpuCacheTranslator;
+
+/// Uses inotify on the directories holding the files, so files replaced by a
+/// rename are seen too. Paths are made absolute and resolved; each symlink on
+/// the way is watched in its parent directory, so repointing a "latest" link
+/// counts as a change. Files on network file systems, which do not report
+/// changes made by other hosts, are polled, as is everything when inotify is
+/// unavailable or GPUCACHE_WATCH_POLL is set. Events are debounced and then
+/// handled from a Maya timer callback, on the main thread.
+class GpuCacheFileWatcher
+{
+public :
+        static GpuCacheFileWatcher& Instance();
+
+        /// Replaces the set of files 'translator' depends on.
+        void Watch( GpuCacheTranslator* translator, const std::vector<std::string>& paths );
+
+        void Unwatch( GpuCacheTranslator* translator );
+
+        /// Drops every watch and the timer, used when the plugin is unloaded.
+        void Shutdown();
+
+private :
+        GpuCacheFileWatcher();
+
+        struct FileState
+        {
+                FileState() : modified(0), size(0), inode(0), polled(false), pendingSince(0.0) {}
+
+                long long modified;     // nanoseconds
+                long long size;
+                long long inode;
+                bool polled;            // on a network file system
+                double pendingSince;    // 0 when no change is pending
+                std::set<GpuCacheTranslator*> dependents;
+                std::vector<std::string> triggers;
+                std::vector<std::string> directories;   // watched directories it holds a reference on
+        };
+
+        /// A watched directory, released when the last file holding it lets go.
+        /// Paths reaching the same directory share one inotify watch, which
+        /// goes once none of them is left.
+        struct DirectoryWatch
+        {
+                int descriptor;
+                unsigned int references;
+        };
+
+        static void timerCallback( float elapsedTime, float lastTime, void* clientData );
+
+        void update();
+        void readEvents( double now );
+        void poll( double now );
+        /// Watches 'path' and every symlink leading to it, registering the
+        /// entries whose events mean 'path' may have changed. Returns false if
+        /// any of them could not be watched.
+        bool addWatches( const std::string& path, FileState& state );
+        void removeWatches( const std::string& path, FileState& state );
+        /// Watches 'directory', or adds a reference to its watch. Returns
+        /// false, holding no reference, if it cannot be watched.
+        bool addDirectoryWatch( const std::string& directory );
+        void releaseDirectoryWatch( const std::string& directory );
+        void startTimer();
+        void stopTimer();
+
+        std::map<std::string, FileState> m_files;
+        std::map<GpuCacheTranslator*, std::vector<std::string> > m_translators;
+        std::map<std::string, std::set<std::string> > m_triggers;  // directory entry -> watched files
+        std::map<int, std::set<std::string> > m_directories;    // inotify watch descriptor -> directories
+        std::map<std::string, DirectoryWatch> m_watchedDirectories;
+        int m_inotify;
+        bool m_polling;
+        double m_lastPoll;
+        MCallbackId m_timer;
+        bool m_hasTimer;
+};
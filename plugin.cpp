@@ -1,5 +1,7 @@
 
 #include "gpuCacheTranslator.h"
+#include "gpuCacheLog.h"
+#include "gpuCacheWatcher.h"
 
 #include <extension/Extension.h>
 #include <maya/MTypes.h> 
@@ -24,6 +26,7 @@ extern "C"
         MGlobal::displayInfo(info);
 
         extension.Requires( "gpuCache" );
+        GpuCacheGeometrySource::StartTracking();
         status = extension.RegisterTranslator( "gpuCache",
                                                "",
                                                GpuCacheTranslator::creator,
@@ -32,6 +35,11 @@ extern "C"
 
     DLLEXPORT void deinitializeExtension( CExtension& extension )
     {
+        GpuCacheFileWatcher::Instance().Shutdown();
+        GpuCacheGeometrySource::StopTracking();
+
+        // hand the last queued messages to Arnold before the plugin goes away
+        GpuCacheLog::Shutdown();
     }
 
 } // extern "C"
@@ -0,0 +1,283 @@
+"""Renders the gpuCache nodes of a scene two ways and compares the results.
+
+Run it with mayapy, with MtoA, the gpuCache plugin and the alembic_loader
+procedural all loadable (ARNOLD_PLUGIN_PATH):
+
+    mayapy gpuCacheCompare.py <mode> scene.ma
+
+Each variant opens the scene, changes the gpuCache nodes, exports the scene
+with arnoldExportAss, then loads the .ass in Arnold and expands every
+procedural (procedural_force_expand with a free render, which also applies
+the operators). The expansion time, memory and node counts of each variant
+are printed side by side, and modes that must not change the render also
+diff the parameters of every expanded shape.
+
+Modes:
+    overrides   compileOverrides off against on. Any difference in the
+                expanded shapes' parameters, user data included, is listed
+                and makes the script exit with 1.
+    layers      cacheLayers against the multi-node setup it replaces: every
+                node with layers is split into one node on cacheFileName and
+                a duplicate per layer archive, each read by its own
+                procedural. Only the stats are compared, the setups are not
+                meant to expand the same shapes.
+    batch       batchByArchive off, one procedural per node, against on.
+                Both must expand as many polymesh, curves and points nodes,
+                or the script exits with 1.
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+
+def OpenScene(scene):
+    import maya.cmds as cmds
+    cmds.file(scene, open=True, force=True)
+
+
+def GpuCacheNodes():
+    import maya.cmds as cmds
+    return cmds.ls(type='gpuCache', long=True) or []
+
+
+def SetOnAll(attribute, value):
+    import maya.cmds as cmds
+    for node in GpuCacheNodes():
+        if cmds.attributeQuery(attribute, node=node, exists=True):
+            cmds.setAttr('%s.%s' % (node, attribute), value)
+
+
+def SplitLayers():
+    """Replaces each layered node by one node per archive."""
+    import maya.cmds as cmds
+    for node in GpuCacheNodes():
+        if not cmds.attributeQuery('cacheLayers', node=node, exists=True):
+            continue
+        value = cmds.getAttr(node + '.cacheLayers') or ''
+        layers = [layer.strip() for layer in value.split(';') if layer.strip()]
+        if not layers:
+            continue
+        cmds.setAttr(node + '.cacheLayers', '', type='string')
+        transform = cmds.listRelatives(node, parent=True, fullPath=True)[0]
+        for layer in layers:
+            duplicate = cmds.duplicate(transform)[0]
+            shape = cmds.listRelatives(duplicate, shapes=True, fullPath=True, type='gpuCache')[0]
+            cmds.setAttr(shape + '.cacheFileName', layer, type='string')
+
+
+def ExportAss(filename):
+    import maya.cmds as cmds
+    cmds.arnoldExportAss(filename=filename)
+
+
+def ParameterValue(ai, node, name, paramType):
+    """Comparable value of one parameter, None for the types left out."""
+    if paramType == ai.AI_TYPE_BOOLEAN:
+        return ai.AiNodeGetBool(node, name)
+    if paramType == ai.AI_TYPE_BYTE:
+        return ai.AiNodeGetByte(node, name)
+    if paramType == ai.AI_TYPE_INT:
+        return ai.AiNodeGetInt(node, name)
+    if paramType == ai.AI_TYPE_UINT:
+        return ai.AiNodeGetUInt(node, name)
+    if paramType == ai.AI_TYPE_FLOAT:
+        return round(ai.AiNodeGetFlt(node, name), 6)
+    if paramType in (ai.AI_TYPE_STRING, ai.AI_TYPE_ENUM):
+        return str(ai.AiNodeGetStr(node, name))
+    if paramType == ai.AI_TYPE_VECTOR:
+        v = ai.AiNodeGetVec(node, name)
+        return (round(v.x, 6), round(v.y, 6), round(v.z, 6))
+    if paramType == ai.AI_TYPE_RGB:
+        c = ai.AiNodeGetRGB(node, name)
+        return (round(c.r, 6), round(c.g, 6), round(c.b, 6))
+    if paramType == ai.AI_TYPE_NODE:
+        target = ai.AiNodeGetPtr(node, name)
+        return ai.AiNodeGetName(target) if target else None
+    if paramType == ai.AI_TYPE_ARRAY:
+        array = ai.AiNodeGetArray(node, name)
+        if not array:
+            return None
+        # geometry arrays are compared by size, overrides never touch them
+        return ('array', ai.AiArrayGetType(array), ai.AiArrayGetNumElements(array), ai.AiArrayGetNumKeys(array))
+    return None
+
+
+def ShapeParameters(ai, node):
+    values = {}
+    entry = ai.AiNodeGetNodeEntry(node)
+    it = ai.AiNodeEntryGetParamIterator(entry)
+    while not ai.AiParamIteratorFinished(it):
+        param = ai.AiParamIteratorGetNext(it)
+        name = str(ai.AiParamGetName(param))
+        values[name] = ParameterValue(ai, node, name, ai.AiParamGetType(param))
+    ai.AiParamIteratorDestroy(it)
+
+    it = ai.AiNodeGetUserParamIterator(node)
+    while not ai.AiUserParamIteratorFinished(it):
+        param = ai.AiUserParamIteratorGetNext(it)
+        name = str(ai.AiUserParamGetName(param))
+        values['user:' + name] = ParameterValue(ai, node, name, ai.AiUserParamGetType(param))
+    ai.AiUserParamIteratorDestroy(it)
+    return values
+
+
+def Expand(assFile, collectShapes):
+    """Loads and expands 'assFile'. Returns its stats and, if asked, the
+    parameters of every expanded shape by node name."""
+    import arnold as ai
+
+    ai.AiBegin()
+    ai.AiMsgSetConsoleFlags(ai.AI_LOG_WARNINGS | ai.AI_LOG_ERRORS)
+    start = time.time()
+    ai.AiASSLoad(assFile, ai.AI_NODE_ALL)
+    loaded = time.time()
+
+    options = ai.AiUniverseGetOptions()
+    ai.AiNodeSetBool(options, 'procedural_force_expand', True)
+    ai.AiNodeSetBool(options, 'skip_license_check', True)
+    ai.AiRender(ai.AI_RENDER_MODE_FREE)
+    expanded = time.time()
+
+    stats = {
+        'load (s)': loaded - start,
+        'expand (s)': expanded - loaded,
+        'memory (MB)': ai.AiMsgUtilGetUsedMemory() / 1048576.0,
+    }
+    shapes = {}
+    counts = {}
+    it = ai.AiUniverseGetNodeIterator(ai.AI_NODE_ALL)
+    while not ai.AiNodeIteratorFinished(it):
+        node = ai.AiNodeIteratorGetNext(it)
+        nodeType = str(ai.AiNodeEntryGetName(ai.AiNodeGetNodeEntry(node)))
+        counts[nodeType] = counts.get(nodeType, 0) + 1
+        if collectShapes and ai.AiNodeEntryGetType(ai.AiNodeGetNodeEntry(node)) == ai.AI_NODE_SHAPE and \
+           nodeType not in ('alembic_loader', 'procedural'):
+            shapes[str(ai.AiNodeGetName(node))] = ShapeParameters(ai, node)
+    ai.AiNodeIteratorDestroy(it)
+    for nodeType in ('alembic_loader', 'polymesh', 'curves', 'points', 'ginstance', 'set_parameter'):
+        stats['%s nodes' % nodeType] = counts.get(nodeType, 0)
+
+    ai.AiEnd()
+    return stats, shapes
+
+
+def RunVariants(scene, variants, collectShapes, workDir):
+    results = []
+    for label, setup in variants:
+        OpenScene(scene)
+        setup()
+        assFile = os.path.join(workDir, label.replace(' ', '_') + '.ass')
+        ExportAss(assFile)
+        stats, shapes = Expand(assFile, collectShapes)
+        results.append((label, stats, shapes))
+    return results
+
+
+def PrintStats(results):
+    keys = sorted(set(k for _, stats, _ in results for k in stats))
+    width = max(len(k) for k in keys)
+    column = max(20, max(len(label) for label, _, _ in results) + 2)
+    print(' ' * width + ''.join(label.rjust(column) for label, _, _ in results))
+    for key in keys:
+        row = ''
+        for _, stats, _ in results:
+            value = stats.get(key, '')
+            row += ('%.3f' % value if isinstance(value, float) else str(value)).rjust(column)
+        print(key.ljust(width) + row)
+
+
+def DiffShapes(reference, other):
+    """Lines describing every difference between two runs' shapes."""
+    lines = []
+    for name in sorted(set(reference) | set(other)):
+        if name not in other:
+            lines.append('%s: missing' % name)
+            continue
+        if name not in reference:
+            lines.append('%s: extra' % name)
+            continue
+        a, b = reference[name], other[name]
+        for param in sorted(set(a) | set(b)):
+            if a.get(param) != b.get(param):
+                lines.append('%s.%s: %r != %r' % (name, param, a.get(param), b.get(param)))
+    return lines
+
+
+def CompareOverrides(scene, workDir):
+    variants = [
+        ('procedural', lambda: SetOnAll('compileOverrides', False)),
+        ('operators', lambda: SetOnAll('compileOverrides', True)),
+    ]
+    results = RunVariants(scene, variants, True, workDir)
+    PrintStats(results)
+
+    differences = DiffShapes(results[0][2], results[1][2])
+    print('%d shapes compared, %d differences' % (len(results[0][2]), len(differences)))
+    for line in differences:
+        print('  ' + line)
+    return 1 if differences else 0
+
+
+def CompareLayers(scene, workDir):
+    variants = [
+        ('one node per archive', SplitLayers),
+        ('layered', lambda: None),
+    ]
+    PrintStats(RunVariants(scene, variants, False, workDir))
+    return 0
+
+
+def CompareBatches(scene, workDir):
+    variants = [
+        ('one procedural per node', lambda: SetOnAll('batchByArchive', False)),
+        ('batched', lambda: SetOnAll('batchByArchive', True)),
+    ]
+    results = RunVariants(scene, variants, False, workDir)
+    PrintStats(results)
+
+    shapeCounts = ['%s nodes' % nodeType for nodeType in ('polymesh', 'curves', 'points')]
+    different = [key for key in shapeCounts if results[0][1][key] != results[1][1][key]]
+    for key in different:
+        print('%s: %d != %d' % (key, results[0][1][key], results[1][1][key]))
+    return 1 if different else 0
+
+
+MODES = {
+    'overrides': CompareOverrides,
+    'layers': CompareLayers,
+    'batch': CompareBatches,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('mode', choices=sorted(MODES))
+    parser.add_argument('scene')
+    parser.add_argument('--keep', action='store_true', help='keep the exported .ass files')
+    args = parser.parse_args()
+
+    import maya.standalone
+    maya.standalone.initialize()
+    import maya.cmds as cmds
+    cmds.loadPlugin('gpuCache', quiet=True)
+    cmds.loadPlugin('mtoa', quiet=True)
+
+    workDir = tempfile.mkdtemp(prefix='gpuCacheCompare')
+    try:
+        status = MODES[args.mode](os.path.abspath(args.scene), workDir)
+    finally:
+        if args.keep:
+            print('exported scenes kept in %s' % workDir)
+        else:
+            shutil.rmtree(workDir, ignore_errors=True)
+    sys.exit(status)
+
+
+if __name__ == '__main__':
+    main()
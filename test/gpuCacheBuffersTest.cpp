@@ -0,0 +1,149 @@
+/* (c)2012 BlueBolt Ltd. All rights reserved.
+ *
+ * gpuCacheBuffersTest.cpp
+ *
+ *  Drives GpuCacheExportBuffers with synthetic polymesh, points and curves
+ *  buffers and checks the Arnold parameters it fills. Needs Arnold only.
+ */
+
+#include "../gpuCacheBuffers.h"
+
+#include <cstdio>
+
+namespace
+{
+
+int failures = 0;
+
+void check( bool condition, const char* what )
+{
+        if (!condition)
+        {
+                fprintf(stderr, "FAILED: %s\n", what);
+                ++failures;
+        }
+}
+
+unsigned int numElements( AtNode* node, const char* param )
+{
+        AtArray* array = AiNodeGetArray( node, param );
+        return array ? AiArrayGetNumElements( array ) : 0;
+}
+
+// a unit quad as two triangles, split into two face groups
+const float kQuadPositions[] = { 0,0,0,  1,0,0,  1,1,0,  0,1,0 };
+const float kQuadNormals[] = { 0,0,1,  0,0,1,  0,0,1,  0,0,1 };
+const float kQuadUvs[] = { 0,0,  1,0,  1,1,  0,1 };
+const unsigned int kQuadGroup0[] = { 0, 1, 2 };
+const unsigned int kQuadGroup1[] = { 0, 2, 3 };
+
+void testPolymesh()
+{
+        GpuCacheBuffers buffers;
+        buffers.kind = GpuCacheBuffers::kPolymesh;
+        buffers.positions = kQuadPositions;
+        buffers.normals = kQuadNormals;
+        buffers.uvs = kQuadUvs;
+        buffers.numVertices = 4;
+        buffers.indexRanges.push_back( GpuCacheBuffers::IndexRange( kQuadGroup0, 3 ) );
+        buffers.indexRanges.push_back( GpuCacheBuffers::IndexRange( kQuadGroup1, 3 ) );
+
+        check( std::string(GpuCacheBuffersNodeType(buffers)) == "polymesh", "polymesh node type" );
+
+        AtNode* node = AiNode( GpuCacheBuffersNodeType(buffers) );
+        check( GpuCacheExportBuffers( buffers, node ), "polymesh exported" );
+        check( numElements( node, "vlist" ) == 4, "polymesh vlist" );
+        check( numElements( node, "nlist" ) == 4, "polymesh nlist" );
+        check( numElements( node, "uvlist" ) == 4, "polymesh uvlist" );
+        check( numElements( node, "nsides" ) == 0, "polymesh nsides left to triangles" );
+
+        // the face groups end up one after the other
+        AtArray* vidxs = AiNodeGetArray( node, "vidxs" );
+        check( vidxs && AiArrayGetNumElements(vidxs) == 6, "polymesh vidxs" );
+        if (vidxs && AiArrayGetNumElements(vidxs) == 6)
+        {
+                const unsigned int expected[] = { 0, 1, 2, 0, 2, 3 };
+                for (unsigned int i = 0; i < 6; ++i)
+                        check( AiArrayGetUInt( vidxs, i ) == expected[i], "polymesh vidxs order" );
+        }
+        check( numElements( node, "nidxs" ) == 6, "polymesh nidxs" );
+        check( numElements( node, "uvidxs" ) == 6, "polymesh uvidxs" );
+
+        AtVector p = AiArrayGetVec( AiNodeGetArray( node, "vlist" ), 2 );
+        check( p.x == 1.0f && p.y == 1.0f && p.z == 0.0f, "polymesh positions copied" );
+
+        // no indices at all leaves the node alone
+        GpuCacheBuffers empty = buffers;
+        empty.indexRanges.clear();
+        AtNode* emptyNode = AiNode( "polymesh" );
+        check( !GpuCacheExportBuffers( empty, emptyNode ), "polymesh without indices rejected" );
+        check( numElements( emptyNode, "vlist" ) == 0, "rejected polymesh left untouched" );
+}
+
+void testPoints()
+{
+        const float positions[] = { 0,0,0,  1,2,3,  4,5,6 };
+        const float radius[] = { 0.1f, 0.2f, 0.3f };
+
+        GpuCacheBuffers buffers;
+        buffers.kind = GpuCacheBuffers::kPoints;
+        buffers.positions = positions;
+        buffers.radius = radius;
+        buffers.numVertices = 3;
+
+        check( std::string(GpuCacheBuffersNodeType(buffers)) == "points", "points node type" );
+
+        AtNode* node = AiNode( GpuCacheBuffersNodeType(buffers) );
+        check( GpuCacheExportBuffers( buffers, node ), "points exported" );
+        check( numElements( node, "points" ) == 3, "points positions" );
+        check( numElements( node, "radius" ) == 3, "points radius" );
+        check( AiArrayGetFlt( AiNodeGetArray( node, "radius" ), 2 ) == 0.3f, "points radius copied" );
+}
+
+void testCurves()
+{
+        const float positions[] = { 0,0,0,  0,1,0,  0,2,0,  1,0,0,  1,1,0 };
+        const unsigned int counts[] = { 3, 2 };
+
+        GpuCacheBuffers buffers;
+        buffers.kind = GpuCacheBuffers::kCurves;
+        buffers.positions = positions;
+        buffers.numVertices = 5;
+        buffers.counts = counts;
+        buffers.numCounts = 2;
+
+        check( std::string(GpuCacheBuffersNodeType(buffers)) == "curves", "curves node type" );
+
+        AtNode* node = AiNode( GpuCacheBuffersNodeType(buffers) );
+        check( GpuCacheExportBuffers( buffers, node ), "curves exported" );
+        check( numElements( node, "points" ) == 5, "curves points" );
+        check( numElements( node, "num_points" ) == 2, "curves num_points" );
+        check( AiArrayGetUInt( AiNodeGetArray( node, "num_points" ), 0 ) == 3, "curves num_points copied" );
+
+        // curves without counts are rejected before anything is set
+        GpuCacheBuffers noCounts = buffers;
+        noCounts.counts = NULL;
+        noCounts.numCounts = 0;
+        AtNode* noCountsNode = AiNode( "curves" );
+        check( !GpuCacheExportBuffers( noCounts, noCountsNode ), "curves without counts rejected" );
+        check( numElements( noCountsNode, "points" ) == 0, "rejected curves left untouched" );
+}
+
+} // namespace
+
+int main()
+{
+        AiBegin();
+        testPolymesh();
+        testPoints();
+        testCurves();
+        AiEnd();
+
+        if (failures > 0)
+        {
+                fprintf(stderr, "%d checks failed\n", failures);
+                return 1;
+        }
+        printf("all checks passed\n");
+        return 0;
+}